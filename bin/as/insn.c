@@ -632,9 +632,13 @@ struct insn insns[] =
 
     { "clts", 0, { }, 2, { 0x0F, 0x06 }, 0 },
     { "cpuid", 0, { }, 2, { 0x0F, 0xA2 }, 0 },
+    { "rdtsc", 0, { }, 2, { 0x0F, 0x31 }, 0 },
     { "pause", 0, { }, 2, { 0xF3, 0x90 }, 0 },
     { "rdmsr", 0, { }, 2, { 0x0F, 0x32 }, 0 },
     { "wrmsr", 0, { }, 2, { 0x0F, 0x30 }, 0 },
+    { "swapgs", 0, { }, 3, { 0x0F, 0x01, 0xF8 }, I_NO_BITS_16 | I_NO_BITS_32 },
+    { "syscall", 0, { }, 2, { 0x0F, 0x05 }, I_NO_BITS_16 | I_NO_BITS_32 },
+    { "sysretq", 0, { }, 2, { 0x0F, 0x07 }, I_DATA_64 | I_NO_BITS_16 | I_NO_BITS_32 },
     { "sfence", 0, { }, 3, { 0x0F, 0xAE, 0xF8 }, 0 },
 
     { "finit", 0, { }, 3, { 0x9B, 0xDB, 0xE3 }, 0 },
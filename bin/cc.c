@@ -30,6 +30,10 @@
 #include <string.h>
 #include <stdarg.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <spawn.h>
+
+extern char **environ;
 
 #ifndef BINDIR
 #define BINDIR "/usr/bin"
@@ -214,7 +218,9 @@ morph(name, ext)
 
 /* run the command indicated by 'args', which will
    output to 'out'. 'out' will be removed if the program
-   returns an error. */
+   returns an error. the command is spawned rather than
+   forked and exec'd: there's no point in copying our
+   address space only to throw it away immediately. */
 
 run(args, out)
     struct list * args;
@@ -222,13 +228,10 @@ run(args, out)
 {
     pid_t pid;
     int status;
+    int err;
 
-    if ((pid = fork()) == 0) {
-        execv(args->s[0], args->s);
-        error("can't exec '%s': %s", args->s[0], strerror(errno));
-    } 
-
-    if (pid == -1) error("can't fork: %s", strerror(errno));
+    err = posix_spawn(&pid, args->s[0], NULL, NULL, args->s, environ);
+    if (err) error("can't exec '%s': %s", args->s[0], strerror(err));
 
     while (pid != wait(&status)) ;
 
@@ -84,6 +84,21 @@ struct madt_cpu
 
 #define MADT_CPU_ENABLED 0x01   /* madt_cpu.flags: CPU is enabled */
 
+/* CPUs whose APIC IDs don't fit in a byte are listed in entries of their
+   own, in place of madt_cpu. the flags are the same (MADT_CPU_*). */
+
+#define MADT_ENTRY_X2APIC 9     /* madt_entry.type: local x2APIC (CPU) */
+
+struct madt_x2apic
+{
+    struct madt_entry entry;
+
+    unsigned short dontcare;
+    unsigned id;                /* x2APIC ID */
+    unsigned flags;             /* MADT_CPU_* */
+    unsigned uid;
+};
+
 struct madt
 {
     struct sdt sdt;
@@ -95,10 +110,125 @@ struct madt
 
 #define MADT_PICS 0x00000001    /* madt.flags: legacy 8259s installed */
 
+/* the HPET table describes the high precision event timer, if present.
+   the register block is described by an ACPI "generic address structure"
+   which we flatten here; its 64-bit address isn't naturally aligned. */
+
+#define HPET_SIG 0x54455048     /* 'HPET' */
+
+struct hpet
+{
+    struct sdt sdt;
+
+    unsigned id;                /* event timer block ID */
+    unsigned char space;        /* HPET_SPACE_* (address space ID) */
+    unsigned char dontcare[3];
+    unsigned addr_lo;           /* physical address of register block */
+    unsigned addr_hi;
+    unsigned char number;       /* HPET sequence number */
+};
+
+#define HPET_SPACE_MEMORY 0     /* hpet.space: memory-mapped registers */
+
+/* the SRAT ("system resource affinity table") assigns CPUs and ranges of
+   RAM to proximity domains, i.e., NUMA nodes. its entries are headed like
+   those of the MADT. many fields here aren't naturally aligned, so wide
+   ones are split into halves; the domain of a CPU is split into pieces. */
+
+#define SRAT_SIG 0x54415253     /* 'SRAT' */
+
+struct srat
+{
+    struct sdt sdt;
+
+    unsigned char dontcare[12];
+    struct madt_entry entries[1];   /* unbounded */
+};
+
+#define SRAT_ENTRY_CPU      0   /* madt_entry.type: local APIC */
+#define SRAT_ENTRY_MEMORY   1   /* madt_entry.type: memory range */
+#define SRAT_ENTRY_X2APIC   2   /* madt_entry.type: local x2APIC */
+
+struct srat_cpu
+{
+    struct madt_entry entry;
+
+    unsigned char domain_lo;    /* proximity domain bits 7:0 */
+    unsigned char id;           /* local APIC ID */
+    unsigned flags;             /* SRAT_ENABLED */
+    unsigned char sapic;
+    unsigned char domain_hi[3]; /* proximity domain bits 31:8 */
+};
+
+struct srat_x2apic
+{
+    struct madt_entry entry;
+
+    unsigned short dontcare;
+    unsigned domain;            /* proximity domain */
+    unsigned id;                /* x2APIC ID */
+    unsigned flags;             /* SRAT_ENABLED */
+};
+
+struct srat_memory
+{
+    struct madt_entry entry;
+
+    unsigned short domain_lo;   /* proximity domain, in two halves */
+    unsigned short domain_hi;
+    unsigned short dontcare0;
+    unsigned base_lo;           /* physical base address */
+    unsigned base_hi;
+    unsigned len_lo;            /* length in bytes */
+    unsigned len_hi;
+    unsigned dontcare1;
+    unsigned flags;             /* SRAT_ENABLED */
+};
+
+#define SRAT_ENABLED 0x00000001 /* srat_*.flags: entry is valid */
+
+/* the SLIT ("system locality information table") gives the relative cost
+   of memory accesses between proximity domains, as an N x N matrix of
+   bytes: row i holds the distances from domain i. local access is 10. */
+
+#define SLIT_SIG 0x54494C53     /* 'SLIT' */
+
+struct slit
+{
+    struct sdt sdt;
+
+    unsigned nr_lo;             /* number of domains (64 bits) */
+    unsigned nr_hi;
+    unsigned char dist[1];      /* unbounded: nr * nr entries */
+};
+
+#define SLIT_LOCAL      10      /* distance from a domain to itself */
+#define SLIT_REMOTE     20      /* assumed, when there's no SLIT */
+
+/* acpi_init() renumbers the proximity domains it finds in the SRAT as
+   nodes, [0, nr_nodes), in order of appearance. the RAM ranges in the
+   SRAT are kept, with their nodes, for page_numa() to sort pmap[] by. */
+
+#define NR_NUMA_RANGES  (NR_NODES * 4)
+
+struct numa_range
+{
+    unsigned long base;         /* physical address */
+    unsigned long len;          /* length in bytes */
+    int node;
+};
+
 #ifdef _KERNEL
 
 extern struct madt *madt;
-extern struct madt_cpu *acpi_cpu();
+extern struct hpet *hpet;
+extern unsigned acpi_cpus[];
+extern int nr_acpi_cpus;
+extern int nr_nodes;
+extern struct numa_range numa_ranges[];
+extern int nr_numa_ranges;
+extern acpi_node();
+extern acpi_distance();
 
 #endif /* _KERNEL */
 
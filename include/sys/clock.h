@@ -25,10 +25,65 @@
 #ifndef _SYS_CLOCK_H
 #define _SYS_CLOCK_H
 
+struct timespec
+{
+    time_t tv_sec;              /* seconds since the epoch.. */
+    long tv_nsec;               /* ..plus nanoseconds */
+};
+
+/* the kernel shares the time page with every process, read-only, at
+   TIME_PAGE (see sys/param.h), so user code can tell the time without a
+   system call (see gettime() in libc). the kernel updates it every tick.
+
+   the page is protected by a seqlock: 'seq' is odd while an update is in
+   progress. a reader reads 'seq', then the rest, then 'seq' again; if it
+   was odd, or changed, the reader must try again. the time is then 'sec'
+   seconds plus 'nsec' + (((TSC - 'tsc') * 'mult') >> TIME_SHIFT) ns. */
+
+#define TIME_SHIFT  32
+
+struct timepage
+{
+    unsigned long seq;          /* sequence number */
+    time_t sec;                 /* time when the TSC read 'tsc'.. */
+    unsigned long nsec;         /* ..(nanoseconds part) */
+    unsigned long tsc;
+    unsigned long mult;         /* ns per TSC tick, << TIME_SHIFT */
+};
+
 #ifdef _KERNEL
 
+/* CPUID.80000007H:EDX.InvariantTSC: the TSC runs at a constant rate,
+   whatever the power state, so it's good as a clock. */
+
+#define CPUID_EXT_7             0x80000007
+#define CPUID_EXT_7_EDX_ITSC    0x00000100
+
 extern time_t time;
+extern struct timepage *timepage;
+extern unsigned long tsc_hz;
+extern unsigned long ticks;
+
 extern time_t epoch();
+extern unsigned long rdtsc();
+extern unsigned long fixmul();
+extern unsigned long nanotime();
+extern clock_init();
+extern pit_start();
+extern pit_done();
+extern clock_sync_bsp();
+extern clock_sync_ap();
+extern clock_tick();
+extern delay();
+
+/* the HPET (kernel/hpet.c), if 'hpet_period' is non-zero */
+
+extern unsigned long hpet_period;
+
+extern hpet_init();
+extern unsigned long hpet_count();
+extern unsigned long hpet_ns();
+extern hpet_oneshot();
 
 #endif /* _KERNEL */
 
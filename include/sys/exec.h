@@ -0,0 +1,66 @@
+/* Copyright (c) 2019 Charles E. Youse (charles@gnuless.org).
+   All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef _SYS_EXEC_H
+#define _SYS_EXEC_H
+
+/* an image is an a.out executable (see a.out.h) for image_exec(). the kernel
+   doesn't know where images come from: the creator of an image just supplies
+   a 'read' function which fills 'buf' with the PAGE_SIZE bytes at 'offset'
+   in the file, returning 0 on success or -1 on error. (bytes past the end
+   of the file may be anything.)
+
+   pages are only read when a process first touches them, and once read,
+   they're kept in the image's page cache until the image is no longer
+   mapped by any process. text pages are mapped directly from the cache,
+   so all processes running an image share them; data pages are mapped
+   copy-on-write from the cache, so they're shared until written. */
+
+#define NR_IMAGE_PAGES      1024        /* max pages of text + data (4MB) */
+
+struct image
+{
+    int (*read)();              /* read(image, offset, buf) */
+    char *cookie;               /* for use by 'read' */
+
+    /* the rest is maintained by the kernel. the creator should zero it. */
+
+    int refs;                   /* vm_regions mapping the image */
+    struct exec exec;           /* copy of the header, once read */
+    pgno_t pages[NR_IMAGE_PAGES];   /* page cache, by page offset */
+};
+
+#ifdef _KERNEL
+
+extern pgno_t image_page();
+extern image_ref();
+extern image_unref();
+extern image_load();
+extern image_exec();
+
+#endif /* _KERNEL */
+
+#endif /* _SYS_EXEC_H */
+
+/* vi: set ts=4 expandtab: */
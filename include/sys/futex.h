@@ -0,0 +1,47 @@
+/* Copyright (c) 2019 Charles E. Youse (charles@gnuless.org).
+   All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef _SYS_FUTEX_H
+#define _SYS_FUTEX_H
+
+/* futexes let user-level locks do without the kernel unless they must
+   block. a lock is an int in user memory, manipulated with atomic
+   instructions; only a thread which finds it contended calls into the
+   kernel, to futex_wait() until the int changes, and only a thread which
+   knows there are waiters calls futex_wake(). the kernel knows nothing
+   about the meaning of the int. waiters are identified by the address
+   space and user address of the int, so unrelated processes using the
+   same address don't collide. */
+
+#ifdef _KERNEL
+
+extern futex_wait();
+extern futex_wake();
+extern futex_init();
+
+#endif /* _KERNEL */
+
+#endif /* _SYS_FUTEX_H */
+
+/* vi: set ts=4 expandtab: */
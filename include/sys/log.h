@@ -0,0 +1,68 @@
+/* Copyright (c) 2019 Charles E. Youse (charles@gnuless.org).
+   All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef _SYS_LOG_H
+#define _SYS_LOG_H
+
+/* kernel messages (from printf()) don't go straight to the console. each
+   CPU appends them to its own ring (in its TSS, see sys/seg.h), stamped
+   with nanotime(), and a low-priority daemon merges the rings in time
+   order and writes the messages out to every registered sink. appending
+   takes no locks, so logging never waits on a slow device or another CPU;
+   if a ring fills, messages are dropped (and the loss reported) instead.
+
+   until log_start(), and after a panic, messages are written immediately.
+
+   the ring (LOG_RING bytes, see sys/param.h) is a sequence of records,
+   each a 'struct logrec' followed by 'len' bytes of text, padded to a
+   multiple of 8 bytes. 'log_head' and 'log_tail' are free-running byte
+   counts, not offsets into the ring: the CPU advances the head, and the
+   daemon the tail, each only once it's done with the record. */
+
+#ifdef _KERNEL
+
+struct logrec
+{
+    unsigned long ns;                   /* nanotime() at append */
+    unsigned len;                       /* length of text */
+    unsigned flags;                     /* LOGREC_* */
+};
+
+#define LOGREC_BOL      0x00000001      /* starts a line */
+
+#define LOGREC_SIZE(len)    ((sizeof(struct logrec) + (len) + 7) & ~7)
+
+#define NR_LOG_SINKS    4               /* console, serial, .. */
+
+extern log_write();
+extern log_sink();
+extern log_start();
+extern log_tick();
+extern log_panic();
+
+#endif /* _KERNEL */
+
+#endif /* _SYS_LOG_H */
+
+/* vi: set ts=4 expandtab: */
@@ -36,15 +36,20 @@
 #define PMAP_PTE        5       /* used by process page tables */
 #define PMAP_ANON       6       /* anonymous RAM assigned to process */
 #define PMAP_SLAB       7       /* belongs to a slab */
+#define PMAP_IMAGE      8       /* in the page cache of an exec image */
+#define PMAP_TIME       9       /* the time page (sys/clock.h) */
 
 struct pmap
 {
     unsigned char type;         /* PMAP_* */
+    unsigned char node;         /* NUMA node of the page */
+    int refs;                   /* PMAP_ANON/IMAGE: mappings (and cache) */
 
     union {
-        struct proc *proc;      /* PMAP_PTE: owner process */
+        struct vmspace *vm;     /* PMAP_PTE: owning address space */
         unsigned long vaddr;    /* PMAP_ANON: virtual address in proc */
         struct slab *slab;      /* PMAP_SLAB: associated slab */
+        struct image *image;    /* PMAP_IMAGE: associated image */
 
         long u;
     } u;
@@ -52,6 +57,8 @@ struct pmap
     LIST_ENTRY(pmap) list;
 };
 
+LIST_HEAD(pmap_list, pmap);
+
 /* get the index of a virtual address 'v' in the page
    table at 'level', where 'level' is:
 
@@ -61,6 +68,15 @@ struct pmap
    0: page table (returns index of PTE proper) */
 
 #define PTES_PER_TABLE  512
+#define PTE_2MB_SIZE    (2L * 1024 * 1024)  /* span of a page directory PTE */
+#define PTE_2MB_OFFSET(v)   (((unsigned long) v) & (PTE_2MB_SIZE - 1))
+#define PTE_1GB_SIZE    (1024L * 1024 * 1024)   /* span of a PDPE */
+
+/* CPUID leaves/bits to determine support for PTE_1GB */
+
+#define CPUID_EXT               0x80000000  /* EAX = max extended leaf */
+#define CPUID_EXT_1             0x80000001
+#define CPUID_EXT_1_EDX_1GB     0x04000000  /* CPUID.80000001H:EDX.Page1GB */
 
 #define PTE_INDEX(v,level) \
   ((((unsigned long) v) >> (((level) * 9) + PAGE_SHIFT)) & (PTES_PER_TABLE-1))
@@ -71,8 +87,10 @@ struct pmap
 
 typedef unsigned long pte_t;
 
+#define PTE_COW     0x0000000000000200L     /* (software) copy-on-write */
 #define PTE_G       0x0000000000000100L     /* global */
 #define PTE_2MB     0x0000000000000080L     /* 2MB mapping */
+#define PTE_1GB     0x0000000000000080L     /* 1GB mapping (PDPE only) */
 #define PTE_D       0x0000000000000040L     /* dirty */
 #define PTE_A       0x0000000000000020L     /* accessed */
 #define PTE_U       0x0000000000000004L     /* user-accessible */
@@ -82,15 +100,33 @@ typedef unsigned long pte_t;
 #define PTE_ADDR(x)     ((x) & ~(0xFFF))    /* address portion */
 #define PTE_FLAGS(x)    ((x) & 0xFFF)       /* flags/other bits */
 
+/* the error code pushed by the CPU for a page fault (VECTOR_PF) */
+
+#define PF_P        0x00000001          /* protection (vs. not present) */
+#define PF_W        0x00000002          /* write access */
+#define PF_U        0x00000004          /* user mode */
+
 #ifdef _KERNEL
 
 extern struct pmap pmap[];
 extern pte_t proto_pml4[];
 
 extern pgno_t page_alloc();
+extern pgno_t page_alloc_2mb();
+extern page_free();
+extern page_free_2mb();
+extern page_ref();
+extern page_release();
 extern pte_t *pte_alloc();
 extern pte_t *page_pte();
 extern char *page_phys();
+extern page_free_list();
+extern page_numa();
+extern page_strip();
+extern page_cow();
+extern page_unmap();
+extern page_fault();
+extern unsigned long cr2();
 
 #endif /* _KERNEL */
 
@@ -27,6 +27,20 @@
 
 #define HZ          100             /* frequency of scheduler ticks */
 
+#define NR_CPUS     64              /* max CPUs (bits in a qword) */
+
+#define NR_NODES    8               /* max NUMA nodes */
+
+/* each CPU's kernel log ring (see sys/log.h) lives in its TSS page,
+   so this must leave room there for the other per-CPU variables. */
+
+#define LOG_RING    2048            /* bytes: must be a power of two */
+
+/* process IDs are allocated from [1, NR_PIDS); 0 belongs to proc0. this
+   must be a multiple of 4096 (64 qwords of bitmap, and 64 bits of those) */
+
+#define NR_PIDS     32768
+
 #define PAGE_SIZE   4096            /* bytes per page */
 #define PAGE_SHIFT  12              /* log2(PAGE_SIZE) */
 
@@ -40,7 +54,23 @@
 /* boundaries of user virtual address space. */
 
 #define USER_BASE   0xFFFFFF8000000000L     /* beginning of text */
-#define KSTACK_TOP  0x0000000000000000L     /* kernel stack at very top */
+#define KSTACK_TOP  0x0000000000000000L     /* kernel stacks at very top */
+
+/* each thread in an address space has a kernel stack in its own slot,
+   counting down from KSTACK_TOP, separated by unmapped guard pages. */
+
+#define NR_KSTACKS      64          /* max threads per address space */
+#define KSTACK_SLOT     ((KSTACK_PAGES + 1) * PAGE_SIZE)
+
+#define KSTACK_SLOT_TOP(s)  (KSTACK_TOP - ((s) * KSTACK_SLOT))
+#define KSTACK_SLOT_BASE(s) (KSTACK_SLOT_TOP(s) - (KSTACK_PAGES * PAGE_SIZE))
+#define KSTACK_BASE         (KSTACK_TOP - (NR_KSTACKS * KSTACK_SLOT))
+
+/* the time page (see sys/clock.h) sits just below the kernel stacks, in
+   every address space. user space proper ends beneath it. */
+
+#define TIME_PAGE   (KSTACK_BASE - PAGE_SIZE)
+#define USER_TOP    TIME_PAGE
 
 /* for now, we assume the system has exactly one I/O APIC, and that the
    APICs are memory-mapped in their standard locations. beware: the APIC
@@ -28,7 +28,8 @@
 struct proc
 {
     /* CPU context. these are accessed by save() and resume(), so
-       do not move them around without ensuring defs.s is in sync. */
+       do not move them around without ensuring defs.s is in sync.
+       'cr3' is a copy of vm->cr3, here for the convenience of resume(). */
 
     pte_t *cr3;
 
@@ -45,6 +46,11 @@ struct proc
         char fxsave[512];       /* ..must be 16-byte aligned.. */
     } cpu;
 
+    /* also used by resume(): the PCID of 'vm' (possibly with CR3_NOFLUSH)
+       which is loaded into CR3 along with 'cr3'. set by tlb_switch(). */
+
+    unsigned long pcid;
+
     /* the remaining fields are only accessed from C, so reordering is OK */
 
     pid_t pid;
@@ -52,19 +58,30 @@ struct proc
     int priority;                       /* scheduling priority: PRIORITY_* */
     char *channel;                      /* event sleeping on */
     token_t tokens;                     /* all held (or required) tokens */
+    struct vmspace *vm;                 /* address space (sys/vm.h) */
+    int kstack;                         /* kernel stack slot in 'vm' */
+    int last_cpu;                       /* where it last ran, or -1 */
+    int (*entry)();                     /* thread_create(): start.. */
+    char *arg;                          /* ..and its argument */
 
-    LIST_HEAD(,pmap) pte_pages;         /* pages allocated for page tables */
     TAILQ_ENTRY(proc) all_links;        /* all_procs */
+    LIST_ENTRY(proc) pid_links;         /* pid_hash[] */
     TAILQ_ENTRY(proc) q_links;          /* runq[] or sleepq[] */
 };
 
+#define RFLAGS_IF   0x200L      /* interrupt flag, in proc->cpu.rflags */
+
 #ifdef _KERNEL
 
 extern struct proc proc0;
 extern struct slab proc_slab;
 
 struct proc *proc_alloc();
+struct proc *proc_find();
 extern pid_t fork();
+extern pid_t thread_create();
+extern pid_t spawn();
+extern proc_exit();
 
 #endif /* _KERNEL */
 
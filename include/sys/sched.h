@@ -64,6 +64,8 @@
 #define VECTORS_PER_PRIORITY        16      /* architecturally-defined */
 
 #define VECTOR_TICK         0xF0        /* APIC timer scheduling tick */
+#define VECTOR_TLB          0xF1        /* TLB shootdown IPI */
+#define VECTOR_HPET         0xF2        /* HPET one-shot event */
 #define VECTOR_SPURIOUS     0xFF        /* APIC was just kidding */
 
 /*
@@ -72,7 +74,7 @@
 
 typedef unsigned long token_t; 
 
-#define TOKEN(x)        ((x) << 1L)     /* token builder: 0 <= x <= 63 */
+#define TOKEN(x)        (1L << (x))     /* token builder: 0 <= x <= 63 */
 
 #define TOKEN_PMAP      TOKEN(0)        /* page allocation/deallocation */
 #define TOKEN_SLAB      TOKEN(1)        /* slab allocation/deallocation */
@@ -81,6 +83,10 @@ typedef unsigned long token_t;
 #define TOKEN_TTY       TOKEN(4)        /* serial device synchronization */
 #define TOKEN_NET       TOKEN(5)        /* network device synchronization */
 #define TOKEN_BLOCK     TOKEN(6)        /* block device synchronization */
+#define TOKEN_TLB       TOKEN(7)        /* TLB shootdown requests */
+#define TOKEN_IMAGE     TOKEN(8)        /* exec image page caches */
+#define TOKEN_VM        TOKEN(9)        /* address spaces (vmspaces) */
+#define TOKEN_FUTEX     TOKEN(10)       /* futex wait queues */
 
 #define TOKEN_ALL       (-1L)
 
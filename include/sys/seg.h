@@ -61,6 +61,34 @@ struct tss
 
     struct tss *this;           /* pointer to self */
     struct proc *curproc;       /* currently executing process */
+    unsigned long user_rsp;     /* scratch for syscall entry */
+
+    /* the remaining per-cpu variables are only accessed from C */
+
+    int cpu;                    /* logical CPU number (index of cpus[]) */
+    unsigned apic_id;           /* local APIC ID */
+    unsigned long pcid_gen;     /* PCID generation of this CPU's TLB */
+    long tsc_offset;            /* add to TSC to agree with the BSP's */
+
+    /* scheduling domains (see kernel/topo.c): bitmaps of the CPUs, by
+       logical number, sharing this one's core, last-level cache, and
+       package (this CPU included). the IDs identify each of those. */
+
+    unsigned long smt_cpus;
+    unsigned long llc_cpus;
+    unsigned long pkg_cpus;
+    unsigned core_id;
+    unsigned llc_id;
+    unsigned pkg_id;
+    int node;                   /* NUMA node (see kernel/acpi.c) */
+
+    /* the kernel log ring (see sys/log.h), LOG_RING from sys/param.h */
+
+    unsigned long log_head;     /* advanced by this CPU.. */
+    unsigned long log_tail;     /* ..and by the log daemon */
+    unsigned long log_lost;     /* messages dropped: ring full */
+    int log_bol;                /* next message starts a line */
+    char log_ring[LOG_RING];
 };
 
 #ifdef _KERNEL
@@ -72,20 +100,38 @@ extern struct tss tss0;     /* BSP's TSS is predefined in locore */
 
 extern struct tss *this();
 
+/* the TSSs of all CPUs, indexed by logical CPU number. CPU 0 is the
+   BSP; the APs are numbered in the order they were started. */
+
+extern struct tss *cpus[];
+extern int nr_cpus;
+
 /* the GDT is defined in locore.s. empty space is reserved
    between gdt_free[] and gdt_end[] for dynamic allocation. */
 
 extern unsigned long gdt[], gdt_free[], gdt_end[];
 
-/* bootstrapping variables. the startup code common to every CPU consults
-   these variables to set up its per-CPU state and determine where to enter
-   the kernel. the BSP's values are predetermined (see locore.s). */
+/* bootstrapping blocks. the startup code common to every CPU consults one
+   of these to set up its per-CPU state, and calls boot_entry(proc) on its
+   stack. the BSP's block is predetermined (see locore.s) and it uses the
+   trampoline stack. the APs are all started at once, so each claims the
+   next of the 'boot_nr' blocks in boot_cpus[] prepared by the BSP; which
+   AP gets which doesn't matter. keep the offsets in defs.s in sync! */
+
+#define BOOT_STACK      60          /* qwords: makes 'struct boot' 512 bytes */
+
+struct boot
+{
+    unsigned long tss;              /* per-CPU GS (overlays TSS) */
+    unsigned long tr;               /* per-CPU task state segment selector */
+    struct proc *proc;              /* argument for kernel entry function */
+    long flag;                      /* set by the AP once it's up */
+    unsigned long stack[BOOT_STACK];
+};
 
-extern unsigned short boot_tr;      /* per-CPU task state segment selector */
-extern unsigned long boot_tss;      /* per-CPU GS (overlays TSS) */
+extern struct boot boot_cpus[];     /* for the APs */
+extern int boot_nr;                 /* number prepared, 0 = BSP booting */
 extern int (*boot_entry)();         /* kernel entry function */
-extern struct proc *boot_proc;      /* argument for kernel entry function */
-extern char boot_flag;              /* boot synchronization flag */
 
 #endif /* _KERNEL */
 
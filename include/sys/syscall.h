@@ -0,0 +1,65 @@
+/* Copyright (c) 2019 Charles E. Youse (charles@gnuless.org).
+   All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef _SYS_SYSCALL_H
+#define _SYS_SYSCALL_H
+
+/* system call numbers, passed in rax to SYSCALL (see locore.s) */
+
+#define SYS_EXIT            0       /* exit() */
+#define SYS_GETPID          1       /* getpid() */
+#define SYS_FUTEX_WAIT      2       /* futex_wait(addr, expected) */
+#define SYS_FUTEX_WAKE      3       /* futex_wake(addr, n) */
+
+#define NR_SYSCALLS         4
+
+#ifdef _KERNEL
+
+/* the frame built by the SYSCALL entry code for syscall(). keep this in
+   sync with locore.s. the arguments are in the order of the user ABI. */
+
+struct syscall
+{
+    unsigned long rdi, rsi, rdx, r10, r8, r9;   /* arguments */
+    unsigned long number;                       /* in: rax, out: result */
+    unsigned long rflags;                       /* user r11 */
+    unsigned long rip;                          /* user rcx */
+    unsigned long rsp;
+};
+
+/* sysent[] maps system call numbers to their kernel implementations */
+
+struct sysent
+{
+    int (*call)();
+};
+
+extern struct sysent sysent[];
+extern long syscall();
+
+#endif /* _KERNEL */
+
+#endif /* _SYS_SYSCALL_H */
+
+/* vi: set ts=4 expandtab: */
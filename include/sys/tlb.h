@@ -0,0 +1,66 @@
+/* Copyright (c) 2019 Charles E. Youse (charles@gnuless.org).
+   All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef _SYS_TLB_H
+#define _SYS_TLB_H
+
+/* when CR4.PCIDE is set, the low 12 bits of CR3 hold the process-context
+   identifier (PCID) which tags the TLB entries created under that CR3.
+   PCID 0 is never assigned to a process; it's the tag used before a
+   process has been given one (or always, if PCIDs aren't supported). */
+
+#define NR_PCIDS        4096
+
+#define CR3_NOFLUSH     0x8000000000000000L     /* keep entries for PCID */
+#define CR4_PCIDE       0x0000000000020000L     /* enable PCIDs */
+
+#define CPUID_1_ECX_PCID    0x00020000          /* CPUID.1:ECX.PCID */
+
+/* when PTEs are changed or removed, the stale entries must be invalidated
+   in the TLBs of every CPU that might have cached them. the changes are
+   accumulated in a tlb_batch, so that one shootdown (one IPI per CPU) can
+   cover them all. the batch covers the range of pages from 'first' through
+   'last', which may include pages that weren't actually changed, so beyond
+   TLB_BATCH_MAX pages it's cheaper to flush the TLB entirely instead. */
+
+#define TLB_BATCH_MAX   32
+
+struct tlb_batch
+{
+    struct vmspace *vm;         /* address space (NULL = kernel) */
+    int nr_pages;               /* number of pages added to batch */
+    unsigned long first;        /* lowest page address */
+    unsigned long last;         /* highest page address */
+};
+
+#ifdef _KERNEL
+
+extern tlb_flush_all();
+extern tlb_batch_flush();
+
+#endif /* _KERNEL */
+
+#endif /* _SYS_TLB_H */
+
+/* vi: set ts=4 expandtab: */
@@ -0,0 +1,92 @@
+/* Copyright (c) 2019 Charles E. Youse (charles@gnuless.org).
+   All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef _SYS_VM_H
+#define _SYS_VM_H
+
+/* the address space of a process is a vmspace, which is shared by all the
+   threads (procs) in it. the fields are protected by TOKEN_VM, except for
+   the PCID-related fields, which belong to tlb_switch() (see tlb.c), and
+   'refs' and 'kstacks', which are protected by TOKEN_PROC. */
+
+struct vmspace
+{
+    pte_t *cr3;                         /* top-level page table */
+    int refs;                           /* threads using the vmspace */
+    unsigned long kstacks;              /* kernel stack slots in use */
+    unsigned long pcid;                 /* PCID, if any.. */
+    unsigned long pcid_gen;             /* ..generation it belongs to */
+    unsigned long tlb_cpus;             /* CPUs that may cache our PTEs */
+
+    struct pmap_list pte_pages;         /* pages allocated for page tables */
+    TAILQ_HEAD(, vm_region) regions;    /* user address space */
+};
+
+/* the user address space of a process is described by its vm_regions.
+   a region is a page-aligned range [start, end) of addresses which may be
+   accessed; its pages are only allocated (zero-filled) when first touched,
+   so a region costs nothing but its struct until then. each process keeps
+   its regions sorted by address on vm->regions.
+
+   a region may instead be backed by an image (sys/exec.h), in which case
+   its pages come from the image's page cache, starting at 'offset' in the
+   file: shared read-only if the region isn't writeable, otherwise COW. */
+
+#define VM_W        0x00000001      /* writeable */
+#define VM_STACK    0x00000002      /* grows down to meet faults below */
+
+/* a VM_STACK region will grow by as much as needed to cover a fault
+   below it, but not beyond VM_STACK_MAX bytes in total. */
+
+#define VM_STACK_MAX    (8L * 1024 * 1024)
+
+struct vm_region
+{
+    unsigned long start;
+    unsigned long end;
+    int flags;                          /* VM_* */
+    struct image *image;                /* backing image, or NULL */
+    unsigned long offset;               /* offset of 'start' in 'image' */
+
+    TAILQ_ENTRY(vm_region) links;       /* vm->regions */
+};
+
+#ifdef _KERNEL
+
+extern struct vmspace vm0;
+extern struct slab vmspace_slab;
+
+extern vm_init();
+extern vm_map();
+extern vm_unmap();
+extern vm_mapped();
+extern vm_fault();
+extern vm_dup();
+extern vm_free();
+
+#endif /* _KERNEL */
+
+#endif /* _SYS_VM_H */
+
+/* vi: set ts=4 expandtab: */
@@ -23,9 +23,35 @@
  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "../include/stddef.h"
+#include "../include/sys/param.h"
 #include "../include/sys/acpi.h"
 
 struct madt *madt;
+struct hpet *hpet;      /* NULL if absent */
+
+/* the APIC IDs of the enabled CPUs, from the MADT */
+
+unsigned acpi_cpus[NR_CPUS];
+int nr_acpi_cpus;
+
+/* NUMA topology, from the SRAT and SLIT. without an SRAT, there's just
+   the one node, 0, which claims all of RAM and every CPU. */
+
+static struct srat *srat;
+static struct slit *slit;
+
+int nr_nodes = 1;
+static unsigned domains[NR_NODES];      /* proximity domain of each node */
+
+static struct {
+    unsigned id;                        /* APIC ID */
+    int node;
+} cpu_nodes[NR_CPUS];
+
+static int nr_cpu_nodes;
+
+struct numa_range numa_ranges[NR_NUMA_RANGES];
+int nr_numa_ranges;
 
 /* the 8-bit checksum of a valid ACPI structure is 0 */
 
@@ -53,8 +79,151 @@ static struct {
 
 #define NR_AREAS sizeof(area)/sizeof(*area)
 
-/* find relevant ACPI data. for now, all we're interested in is
-   the MADT, which acpi_cpu() uses to identify available CPUs. */
+/* fill in acpi_cpus[] in a single pass over the MADT, with the enabled
+   CPUs whether or not their APIC IDs fit in a byte. */
+
+static
+madt_cpus()
+{
+    unsigned base = (unsigned) madt;
+    unsigned offset;
+    unsigned id;
+    int flags;
+
+    offset = ((unsigned) madt->entries) - base;
+    while (offset < madt->sdt.len) {
+        struct madt_entry *entry = (struct madt_entry *) (offset + base);
+
+        flags = 0;
+
+        if (entry->type == MADT_ENTRY_CPU) {
+            id = ((struct madt_cpu *) entry)->id;
+            flags = ((struct madt_cpu *) entry)->flags;
+        } else if (entry->type == MADT_ENTRY_X2APIC) {
+            id = ((struct madt_x2apic *) entry)->id;
+            flags = ((struct madt_x2apic *) entry)->flags;
+        }
+
+        if ((flags & MADT_CPU_ENABLED) && (nr_acpi_cpus < NR_CPUS))
+            acpi_cpus[nr_acpi_cpus++] = id;
+
+        offset += entry->len;
+    }
+}
+
+/* return the node number of proximity 'domain', assigning the next one
+   if it's new. if there are more domains than NR_NODES, the extras are
+   lumped in with node 0, which is better than ignoring their RAM. */
+
+static
+domain_node(domain)
+unsigned domain;
+{
+    int node;
+
+    for (node = 0; node < nr_nodes; ++node)
+        if (domains[node] == domain) return node;
+
+    if (nr_nodes == NR_NODES) return 0;
+    domains[nr_nodes] = domain;
+    return nr_nodes++;
+}
+
+/* record the nodes of the CPUs and RAM ranges listed in the SRAT. the
+   first domain we see becomes node 0 in place of the default. */
+
+static
+srat_nodes()
+{
+    unsigned base = (unsigned) srat;
+    unsigned offset;
+    struct srat_cpu *cpu;
+    struct srat_x2apic *x2apic;
+    struct srat_memory *mem;
+    unsigned domain;
+    unsigned id;
+    int flags;
+
+    nr_nodes = 0;
+
+    offset = ((unsigned) srat->entries) - base;
+    while (offset < srat->sdt.len) {
+        struct madt_entry *entry = (struct madt_entry *) (offset + base);
+
+        flags = 0;
+
+        if (entry->type == SRAT_ENTRY_CPU) {
+            cpu = (struct srat_cpu *) entry;
+            domain = cpu->domain_lo | (cpu->domain_hi[0] << 8)
+                     | (cpu->domain_hi[1] << 16) | (cpu->domain_hi[2] << 24);
+            id = cpu->id;
+            flags = cpu->flags;
+        } else if (entry->type == SRAT_ENTRY_X2APIC) {
+            x2apic = (struct srat_x2apic *) entry;
+            domain = x2apic->domain;
+            id = x2apic->id;
+            flags = x2apic->flags;
+        } else if (entry->type == SRAT_ENTRY_MEMORY) {
+            mem = (struct srat_memory *) entry;
+            domain = mem->domain_lo | (mem->domain_hi << 16);
+
+            if ((mem->flags & SRAT_ENABLED)
+              && (nr_numa_ranges < NR_NUMA_RANGES))
+            {
+                numa_ranges[nr_numa_ranges].base = mem->base_lo
+                                    | (((unsigned long) mem->base_hi) << 32);
+                numa_ranges[nr_numa_ranges].len = mem->len_lo
+                                    | (((unsigned long) mem->len_hi) << 32);
+                numa_ranges[nr_numa_ranges++].node = domain_node(domain);
+            }
+        }
+
+        if ((flags & SRAT_ENABLED) && (nr_cpu_nodes < NR_CPUS)) {
+            cpu_nodes[nr_cpu_nodes].id = id;
+            cpu_nodes[nr_cpu_nodes++].node = domain_node(domain);
+        }
+
+        offset += entry->len;
+    }
+
+    if (nr_nodes == 0) nr_nodes = 1;
+}
+
+/* return the node of the CPU with local APIC 'id' */
+
+acpi_node(id)
+unsigned id;
+{
+    int i;
+
+    for (i = 0; i < nr_cpu_nodes; ++i)
+        if (cpu_nodes[i].id == id) return cpu_nodes[i].node;
+
+    return 0;
+}
+
+/* return the relative cost of an access from node 'from' to RAM on node
+   'to', per the SLIT. in its absence, remote is assumed to be twice local. */
+
+acpi_distance(from, to)
+{
+    unsigned long nr;
+    unsigned a, b;
+
+    if (from == to) return SLIT_LOCAL;
+    if (slit == NULL) return SLIT_REMOTE;
+
+    nr = slit->nr_lo | (((unsigned long) slit->nr_hi) << 32);
+    a = domains[from];
+    b = domains[to];
+    if ((a >= nr) || (b >= nr)) return SLIT_REMOTE;
+
+    return slit->dist[(a * nr) + b];
+}
+
+/* find relevant ACPI data: the MADT, which lists the available CPUs, the
+   HPET table, if any, for hpet_init(), and the SRAT and SLIT, if any, for
+   page_numa() and the CPUs to determine their NUMA nodes. */
 
 acpi_init()
 {
@@ -88,41 +257,32 @@ acpi_init()
     if (rsdt == NULL) panic("can't find ACPI RSDP/RSDT");
 
     /*
-     * now locate the MADT amongst the SDTs listed in the RSDT.
+     * now locate the MADT, HPET, SRAT and SLIT amongst the SDTs
+     * listed in the RSDT.
      */
 
     nr_sdts = (rsdt->sdt.len - (sizeof(rsdt) - sizeof(rsdt->sdts))) / 4;
 
     for (i = 0; i < nr_sdts; ++i) {
         struct sdt *sdt = (struct sdt *) rsdt->sdts[i];
-        if ((sdt->sig == MADT_SIG) && sum(sdt, sdt->len)) {
-            madt = (struct madt *) sdt;
-            return;
-        }
-    }
-
-    panic("can't find ACPI MADT");
-}
 
-/* return the entry for the nth CPU in the system, or NULL if not present */
+        if (!sum(sdt, sdt->len))
+            continue;
 
-struct madt_cpu *
-acpi_cpu(n)
-{
-    unsigned base = (unsigned) madt;
-    unsigned offset;
-
-    offset = ((unsigned) madt->entries) - base;
-    while (offset < madt->sdt.len) {
-        struct madt_entry *entry = (struct madt_entry *) (offset + base);
-
-        if ((entry->type == MADT_ENTRY_CPU) && !n--)
-            return (struct madt_cpu *) entry;
-
-        offset += entry->len;
+        if (sdt->sig == MADT_SIG)
+            madt = (struct madt *) sdt;
+        else if (sdt->sig == HPET_SIG)
+            hpet = (struct hpet *) sdt;
+        else if (sdt->sig == SRAT_SIG)
+            srat = (struct srat *) sdt;
+        else if (sdt->sig == SLIT_SIG)
+            slit = (struct slit *) sdt;
     }
 
-    return NULL;
+    if (madt == NULL) panic("can't find ACPI MADT");
+
+    madt_cpus();
+    if (srat) srat_nodes();
 }
 
 /* vi: set ts=4 expandtab: */
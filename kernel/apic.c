@@ -28,12 +28,38 @@
 #include "../include/sys/page.h"
 #include "../include/sys/sched.h"
 #include "../include/sys/proc.h"
+#include "../include/sys/clock.h"
 
-/* local APIC definitions. for now, we use it in xAPIC (memory-mapped) mode;
-   until the compiler supports inline asm this is faster than MSR access. */
+/* local APIC definitions. if the CPUs support it, we use the APIC in x2APIC
+   mode, where registers are MSRs: EOIs and IPIs are cheaper (especially in
+   VMs, where MMIO traps), and APIC IDs aren't limited to 8 bits. otherwise,
+   we fall back to xAPIC (memory-mapped) mode. the register numbers are the
+   same either way: the xAPIC offset >> 4, or the x2APIC MSR - 0x800. */
 
-#define LAPIC_READ(r)    (*((unsigned *) (LAPIC_BASE + ((r) << 4))))
-#define LAPIC_WRITE(r,v) (*((unsigned *) (LAPIC_BASE + ((r) << 4))) = (v))
+#define LAPIC_MMIO(r)   (*((unsigned *) (LAPIC_BASE + ((r) << 4))))
+#define LAPIC_MSR(r)    (0x800 + (r))
+
+#define LAPIC_READ(r) \
+    (x2apic ? rdmsr(LAPIC_MSR(r)) : LAPIC_MMIO(r))
+
+#define LAPIC_WRITE(r,v) \
+    do { \
+        if (x2apic) \
+            wrmsr(LAPIC_MSR(r), (unsigned long) (v)); \
+        else \
+            LAPIC_MMIO(r) = (v); \
+    } while (0)
+
+#define IA32_APIC_BASE      0x1B        /* APIC base address MSR */
+#define APIC_BASE_EXTD      0x00000400  /* x2APIC mode */
+#define APIC_BASE_EN        0x00000800  /* APIC enabled */
+
+#define CPUID_FEATURES          0x01
+#define CPUID_FEATURES_X2APIC   0x00200000  /* ECX: x2APIC supported */
+
+static int x2apic;              /* non-zero if x2APIC mode */
+
+extern unsigned long rdmsr();
 
 #define LAPIC_ID            0x02        /* identification */
 #define LAPIC_EOI           0x0B        /* end of interrupt */
@@ -42,6 +68,7 @@
 #define LAPIC_CMCI_LVT      0x2F        /* corrected machine check */
 #define LAPIC_ICRLO         0x30        /* interrupt command[31:0] */
 #define LAPIC_ICRHI         0x31        /* interrupt command[63:32] */
+#define LAPIC_ICR           0x30        /* x2APIC: whole 64-bit command */
 #define LAPIC_TIMER_LVT     0x32        /* timer */
 #define LAPIC_THERMAL_LVT   0x33        /* thermal monitor */
 #define LAPIC_PERF_LVT      0x34        /* performance counter */
@@ -57,8 +84,10 @@
 #define LAPIC_SPUR_ENABLE   0x00000100  /* APIC enable bit */
 #define LAPIC_ICRLO_BUSY    0x00001000  /* IPI delivery in progress */
 #define LAPIC_TIMER_DCR_128 0x0000000B  /* divide by 128 */
+#define LAPIC_TIMER_DIV     128         /* divisor set by DCR_128 */
 
 #define LAPIC_ICR_IPI_OTHERS    0x000C4000  /* regular IPI to other CPUs */
+#define LAPIC_ICR_IPI_FIXED     0x00004000  /* regular IPI to target CPU */
 #define LAPIC_ICR_IPI_INIT      0x00004500  /* init IPI to target CPU */
 #define LAPIC_ICR_IPI_STARTUP   0x00004600  /* startup IPI to target CPU */
 
@@ -66,7 +95,18 @@
 
 lapic_id()
 {
-    return LAPIC_READ(LAPIC_ID) >> 24;
+    if (x2apic)
+        return LAPIC_READ(LAPIC_ID);
+    else
+        return LAPIC_READ(LAPIC_ID) >> 24;
+}
+
+/* true if we can send IPIs to the CPU with APIC ID 'id' */
+
+lapic_reachable(id)
+unsigned id;
+{
+    return x2apic || (id < 0xFF);
 }
 
 /* send an EOI */
@@ -79,10 +119,17 @@ lapic_eoi()
 /* called by each CPU during startup. this is probably overly pedantic, as
    the firmware should leave the local APICs in a well-defined state. also,
    some of these LVTs may not exist on all APICs, and there may be others.
-   (at some point we might have to get more fancy and so some probing.) */
+   (at some point we might have to get more fancy and so some probing.)
+
+   if the BSP chose x2APIC mode in apic_init(), switch to it first. the
+   APs mustn't touch their APICs before this, since they start in xAPIC. */
 
 lapic_init()
 {
+    if (x2apic)
+        wrmsr(IA32_APIC_BASE, rdmsr(IA32_APIC_BASE)
+                              | APIC_BASE_EN | APIC_BASE_EXTD);
+
     LAPIC_WRITE(LAPIC_SPUR, LAPIC_SPUR_ENABLE | VECTOR_SPURIOUS);
 
     LAPIC_WRITE(LAPIC_CMCI_LVT, LAPIC_LVT_MASK);
@@ -96,38 +143,119 @@ lapic_init()
     LAPIC_WRITE(LAPIC_EOI, 0);      /* clear any pending interrupt */
 }
 
+/* CPUID leaf 0x15 reports the TSC/crystal clock ratio and (sometimes)
+   the crystal frequency, which also drives the APIC timer. failing that,
+   leaf 0x16 gives the processor base frequency, which is the TSC's. */
+
+#define CPUID_TSC           0x15    /* EAX/EBX = TSC/crystal, ECX = crystal */
+#define CPUID_FREQ          0x16    /* EAX = base MHz */
+
+#define CALIBRATE_MS        50      /* interval for calibration */
+
+/* determine the frequencies of the TSC and the APIC timer (before the
+   divider). we take them from CPUID if we can; otherwise we time both
+   for CALIBRATE_MS against the HPET, if there is one, or else the PIT,
+   which is coarser but still much quicker than the RTC. */
+
+static
+lapic_calibrate(tsc_hz, timer_hz)
+unsigned long *tsc_hz;
+unsigned long *timer_hz;
+{
+    unsigned regs[4];
+    unsigned long crystal;
+    unsigned long tsc;
+    unsigned long ns;
+    unsigned long count;
+    unsigned max;
+
+    *tsc_hz = 0;
+    *timer_hz = 0;
+
+    cpuid(0, 0, regs);
+    max = regs[0];
+
+    if (max >= CPUID_TSC) {
+        cpuid(CPUID_TSC, 0, regs);
+        crystal = regs[2];
+
+        if (regs[0] && regs[1]) {
+            if (crystal)
+                *tsc_hz = (crystal * regs[1]) / regs[0];
+            else if (max >= CPUID_FREQ) {
+                cpuid(CPUID_FREQ, 0, regs);
+                *tsc_hz = regs[0] * 1000000L;
+            }
+        }
+
+        *timer_hz = crystal;
+    }
+
+    if (*tsc_hz && *timer_hz) return;
+
+    if (hpet_period) {
+        LAPIC_WRITE(LAPIC_TIMER_ICR, 0xFFFFFFFF);
+        tsc = rdtsc();
+        ns = hpet_ns();
+        while ((hpet_ns() - ns) < (CALIBRATE_MS * 1000000L)) ;
+        count = 0xFFFFFFFF - LAPIC_READ(LAPIC_TIMER_CCR);
+        tsc = rdtsc() - tsc;
+        ns = hpet_ns() - ns;
+    } else {
+        pit_start(CALIBRATE_MS);
+        LAPIC_WRITE(LAPIC_TIMER_ICR, 0xFFFFFFFF);
+        tsc = rdtsc();
+        while (!pit_done()) ;
+        count = 0xFFFFFFFF - LAPIC_READ(LAPIC_TIMER_CCR);
+        tsc = rdtsc() - tsc;
+        ns = CALIBRATE_MS * 1000000L;
+    }
+
+    if (*timer_hz == 0)
+        *timer_hz = (count * LAPIC_TIMER_DIV * 1000000000L) / ns;
+
+    if (*tsc_hz == 0) *tsc_hz = (tsc * 1000000000L) / ns;
+}
+
 /* called by each processor to start periodic scheduling interrupts */
 
 lapic_ticker()
 {
     static unsigned count;  /* timer ICR value to interrupt at 'HZ' Hz */
+    unsigned long tsc_hz;
+    unsigned long timer_hz;
 
     LAPIC_WRITE(LAPIC_TIMER_DCR, LAPIC_TIMER_DCR_128);
 
     if (count == 0) {
-        /* the BSP must determine the APIC's (rough) frequency.
-           we use the pair of epoch() calls to delay a second. */
+        /* the BSP must determine the APIC's frequency,
+           and gets the TSC's for the clock at the same time. */
 
-        epoch();
-        LAPIC_WRITE(LAPIC_TIMER_ICR, 0xFFFFFFFF);
-        epoch();
-        count = 0xFFFFFFFF - LAPIC_READ(LAPIC_TIMER_CCR);
-        count /= HZ;
+        lapic_calibrate(&tsc_hz, &timer_hz);
+        count = timer_hz / (LAPIC_TIMER_DIV * HZ);
+        clock_init(tsc_hz);
     }
 
     LAPIC_WRITE(LAPIC_TIMER_LVT, LAPIC_LVT_PERIODIC | VECTOR_TICK);
     LAPIC_WRITE(LAPIC_TIMER_ICR, count);
 }
 
-/* internal use only, for lapic_startcpu() and lapic_schedipi() */
+/* internal use only, for lapic_startcpu() and lapic_sendipi(). in x2APIC
+   mode, the ICR is written in one go and there's no busy bit to poll. */
 
 static
 lapic_ipi(target, ipi, vector)
+unsigned target;
 {
     long flags;
 
     ipi |= vector;
 
+    if (x2apic) {
+        wrmsr(LAPIC_MSR(LAPIC_ICR), (((unsigned long) target) << 32) | ipi);
+        return;
+    }
+
     flags = lock();
 
     while (LAPIC_READ(LAPIC_ICRLO) & LAPIC_ICRLO_BUSY)
@@ -139,17 +267,25 @@ lapic_ipi(target, ipi, vector)
     unlock(flags);
 }
 
-/* fire up another CPU (identified by its APIC ID). this is not robust and
-   will just hang if the CPU never comes up. also, the delay loop is bogus;
-   once we have some kind of driver for a timer source we should use that. */
+/* send an IPI with 'vector' to the CPU whose APIC ID is 'target' */
 
-lapic_startcpu(target, entry)
-int entry();
+lapic_sendipi(target, vector)
 {
-    int i;
+    lapic_ipi(target, LAPIC_ICR_IPI_FIXED, vector);
+}
+
+/* the two halves of firing up another CPU (identified by its APIC ID): an
+   INIT IPI puts it in wait-for-SIPI state, and a startup IPI sets it off
+   at 'entry'. the caller must space them out (see start_aps()). */
 
+lapic_init_ipi(target)
+{
     lapic_ipi(target, LAPIC_ICR_IPI_INIT, 0);
-    for (i = 0; i < 1000000; ++i) ;
+}
+
+lapic_startup_ipi(target, entry)
+int entry();
+{
     lapic_ipi(target, LAPIC_ICR_IPI_STARTUP, ADDR_TO_PGNO(entry));
 }
 
@@ -224,10 +360,14 @@ ioapic_configure(pin, vector, flags)
 
 apic_init()
 {
+    unsigned regs[4];
     pte_t *pte;
     int max_rte;
     int i;
 
+    cpuid(CPUID_FEATURES, 0, regs);
+    if (regs[2] & CPUID_FEATURES_X2APIC) x2apic = 1;
+
     pte = page_pte(&proc0, LAPIC_BASE, PTE_P | PTE_2MB);
     *pte = LAPIC_BASE | PTE_2MB | PTE_W | PTE_P;
     pte = page_pte(&proc0, IOAPIC_BASE, PTE_P | PTE_2MB);
@@ -22,10 +22,32 @@
  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
+#include "../include/stddef.h"
 #include "../include/sys/types.h"
+#include "../include/sys/param.h"
+#include "../include/sys/queue.h"
+#include "../include/sys/page.h"
+#include "../include/sys/seg.h"
 #include "../include/sys/clock.h"
 
-time_t time;        /* current time of day */
+time_t time;                    /* current time of day */
+struct timepage *timepage;      /* shared with user space */
+unsigned long tsc_hz;           /* TSC ticks per second */
+unsigned long ticks;            /* scheduler ticks (BSP) since boot */
+
+/* the time is kept relative to an anchor taken at boot, to avoid
+   accumulating rounding errors: 'boot_sec' when the TSC read 'boot_tsc'. */
+
+static time_t boot_sec;
+static unsigned long boot_tsc;
+
+/* nanotime() uses the TSC if it's invariant, scaled by 'ns_mult'
+   (nanoseconds per TSC tick, << 32). otherwise it falls back to the
+   HPET, which is slower to read, or, failing that, to counting
+   scheduler ticks, which is cheap but coarse. */
+
+static int tsc_stable;
+static unsigned long ns_mult;
 
 /* the CMOS/NVRAM/RTC is a 256-byte address space accessed
    via an index register and a data window. */
@@ -40,8 +62,9 @@ nvram(reg)
     return inb(NVRAM_DATA);
 }
 
-/* take a consistent snapshot of the RTC state. in order to do this, we
-   wait for the clock to tick over, so this can take up to a second. */
+/* take a consistent snapshot of the RTC state. we wait out any update in
+   progress (a couple of milliseconds at most) and then read the registers,
+   trying again if an update started while we were reading them. */
 
 struct rtc
 {
@@ -66,16 +89,19 @@ struct rtc *rtc;
     /* these registers must agree with offsets into 'struct rtc' */
 
     static char regs[] = { 0x00, 0x02, 0x04, 0x07, 0x08, 0x09, 0x0a, 0x0b };
-    char *cp = (char *) rtc;
+    char *cp;
     int i;
 
-    /* synchronize to the clock by waiting for an update
-       to start, and then wait for it to complete. */
+    for (;;) {
+        while (nvram(0x0a) & RTC_STATUS_A_BUSY) ;
+
+        cp = (char *) rtc;
+        for (i = 0; i < sizeof(regs); ++i) *cp++ = nvram(regs[i]);
 
-    while (!(nvram(0x0a) & RTC_STATUS_A_BUSY)) ;
-    while (nvram(0x0a) & RTC_STATUS_A_BUSY) ;
+        /* any update changes the seconds, at least */
 
-    for (i = 0; i < sizeof(regs); ++i) *cp++ = nvram(regs[i]);
+        if (nvram(regs[0]) == rtc->second) break;
+    }
 }
 
 /* Howard Hinnant's [public-domain] algorithm to get days offset from epoch */
@@ -105,10 +131,7 @@ bcd(v)
     return (((v >> 4) & 0x0F) * 10) + (v & 0x0F);
 }
 
-/* returns the current UNIX epoch time, as read from the RTC. note that
-   since we read the RTC, this can busy-wait up to a second. the upshot
-   is that consecutive calls to epoch() will return almost exactly one
-   second apart, a "feature" we use to tune the scheduling timers. */
+/* returns the current UNIX epoch time, as read from the RTC. */
 
 time_t
 epoch()
@@ -151,4 +174,201 @@ epoch()
     return time;
 }
 
+/* the PIT (8254) counts at PIT_HZ. its channel 2 can be gated on and off,
+   and its output read back, through port B, so we use it as a one-shot
+   timer to calibrate the others against. */
+
+#define PIT_HZ          1193182
+#define PIT_CH2         0x42        /* channel 2 data */
+#define PIT_CMD         0x43        /* mode/command */
+#define PIT_CH2_MODE0   0xB0        /* ch2, lo/hi byte, interrupt on count */
+
+#define PORTB           0x61
+#define PORTB_GATE2     0x01        /* channel 2 gate */
+#define PORTB_SPKR      0x02        /* speaker data enable */
+#define PORTB_OUT2      0x20        /* channel 2 output */
+
+/* start the PIT counting down 'ms' milliseconds (at most 54) */
+
+pit_start(ms)
+{
+    int count = (PIT_HZ * ms) / 1000;
+    int portb;
+
+    portb = inb(PORTB) & ~(PORTB_GATE2 | PORTB_SPKR);
+    outb(PORTB, portb);
+    outb(PIT_CMD, PIT_CH2_MODE0);
+    outb(PIT_CH2, count & 0xFF);
+    outb(PIT_CH2, (count >> 8) & 0xFF);
+    outb(PORTB, portb | PORTB_GATE2);
+}
+
+/* returns non-zero once the interval started by pit_start() has elapsed */
+
+pit_done()
+{
+    return inb(PORTB) & PORTB_OUT2;
+}
+
+/* called on the BSP once, with the TSC frequency: read the wall clock,
+   choose the source for nanotime() and set up the time page. */
+
+clock_init(hz)
+unsigned long hz;
+{
+    unsigned regs[4];
+    pgno_t pgno;
+
+    boot_sec = epoch();
+    boot_tsc = rdtsc();
+    tsc_hz = hz;
+    ns_mult = (1000000000L << 32) / tsc_hz;
+
+    cpuid(CPUID_EXT, 0, regs);
+
+    if (regs[0] >= CPUID_EXT_7) {
+        cpuid(CPUID_EXT_7, 0, regs);
+        if (regs[3] & CPUID_EXT_7_EDX_ITSC) tsc_stable = 1;
+    }
+
+    pgno = page_alloc(PMAP_TIME, 0L);
+    timepage = (struct timepage *) PGNO_TO_ADDR(pgno);
+    bzero(timepage, PAGE_SIZE);
+    timepage->mult = (1000000000L << TIME_SHIFT) / tsc_hz;
+
+    clock_tick();
+}
+
+/* called by the BSP every tick: bring 'time' and the time page up to date */
+
+clock_tick()
+{
+    unsigned long now;
+    unsigned long elapsed;
+
+    ++ticks;
+    if (timepage == NULL) return;
+
+    now = rdtsc();
+    elapsed = now - boot_tsc;
+
+    ++timepage->seq;
+    timepage->sec = boot_sec + (elapsed / tsc_hz);
+    timepage->nsec = ((elapsed % tsc_hz) * 1000000000L) / tsc_hz;
+    timepage->tsc = now;
+    ++timepage->seq;
+
+    time = timepage->sec;
+}
+
+/* returns monotonic nanoseconds since boot (well, since clock_init()).
+   each CPU corrects its TSC by the offset found by clock_sync_bsp(). */
+
+unsigned long
+nanotime()
+{
+    long tsc;
+
+    if (!tsc_stable) {
+        if (hpet_period) return hpet_ns();
+        return ticks * (1000000000L / HZ);
+    }
+
+    tsc = rdtsc() + this()->tsc_offset - boot_tsc;
+    if (tsc < 0) tsc = 0;   /* an AP may be just behind the BSP at boot */
+
+    return fixmul(tsc, ns_mult);
+}
+
+/* busy-wait for at least 'ns' nanoseconds. the resolution is only as good
+   as nanotime()'s, so this can take up to a tick longer than asked. */
+
+delay(ns)
+unsigned long ns;
+{
+    unsigned long end;
+
+    end = nanotime() + ns;
+    while (nanotime() < end) ;
+}
+
+/* the TSCs of the APs may not agree with the BSP's; those that were reset
+   at different times, for instance. as each AP starts, it and the BSP play
+   SYNC_ROUNDS of ping-pong: the BSP notes its TSC before and after asking
+   for the AP's. the AP's TSC should match the midpoint of the BSP's, and
+   the round with the shortest round trip gives the best estimate. */
+
+#define SYNC_ROUNDS     16
+
+#define SYNC_IDLE       0       /* sync_state: nothing doing */
+#define SYNC_ASK        1       /* BSP wants a TSC value */
+#define SYNC_TOLD       2       /* AP has put it in sync_tsc */
+#define SYNC_DONE       3       /* that's all (AP acks with SYNC_IDLE) */
+
+static int sync_cpu;             /* the AP being synchronized */
+static int sync_state;
+static unsigned long sync_tsc;
+
+/* read a variable shared with another CPU. a function call keeps the
+   compiler from holding it in a register; use 'volatile' when we can */
+
+static
+peek(state)
+int *state;
+{
+    return *state;
+}
+
+/* the BSP's side: called once 'tss' has started and been numbered. */
+
+clock_sync_bsp(tss)
+struct tss *tss;
+{
+    unsigned long best = -1L;
+    unsigned long before;
+    unsigned long after;
+    int i;
+
+    sync_cpu = tss->cpu;
+
+    for (i = 0; i < SYNC_ROUNDS; ++i) {
+        before = rdtsc();
+        sync_state = SYNC_ASK;
+        while (peek(&sync_state) != SYNC_TOLD) ;
+        after = rdtsc();
+
+        if ((after - before) < best) {
+            best = after - before;
+            tss->tsc_offset = (before + ((after - before) / 2)) - sync_tsc;
+        }
+    }
+
+    sync_state = SYNC_DONE;
+    while (peek(&sync_state) != SYNC_IDLE) ;
+}
+
+/* the AP's side, called as soon as it's started. the APs are started
+   together, so each waits its turn: until it's numbered and the BSP
+   names it in 'sync_cpu'. */
+
+clock_sync_ap()
+{
+    int state;
+
+    for (;;) {
+        if (peek(&sync_cpu) != this()->cpu) continue;
+        state = peek(&sync_state);
+
+        if (state == SYNC_DONE) {
+            sync_state = SYNC_IDLE;
+            break;
+        }
+
+        if (state == SYNC_ASK) {
+            sync_tsc = rdtsc();
+            sync_state = SYNC_TOLD;
+        }
+    }
+}
+
 /* vi: set ts=4 expandtab: */
@@ -23,6 +23,7 @@
  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "../include/stdarg.h"
+#include "../include/sys/log.h"
 
 /*
  * driver for 6845-based (CGA/EGA/VGA) 80x25 console.
@@ -62,42 +63,93 @@ read_crtc(reg)
     return inb(CRTC_DATA);
 }
 
+/*
+ * scroll the screen up one line, with a block move, and blank the bottom.
+ */
+
+static
+scroll()
+{
+    int i;
+
+    bcopy(&vram[COLS], vram, (COLS * (ROWS - 1)) * sizeof(*vram));
+
+    for (i = (COLS * (ROWS - 1)); i < (COLS * ROWS); ++i)
+        vram[i] = ' ' | attr;
+
+    cursor -= COLS;
+}
+
 /*
  * send output to console, processing control characters and escape sequences.
+ * VRAM is updated as we go, but the hardware cursor only once, at the end:
+ * port I/O is far slower than memory, especially on emulated hardware.
+ * this is a log sink (see sys/log.h); it's always synchronous, so 'sync'
+ * makes no difference.
  */
 
 static
-putc(c)
+cons_write(buf, len, sync)
+char *buf;
 {
-    switch (c)
-    {
-    case 8: /* backspace */
-        if (cursor % COLS) --cursor;
-        break;
-    case '\n':
-        cursor += COLS;
-        break;
-    case '\r':
-        cursor -= (cursor % COLS);
-        break;
-    default:
-        vram[cursor++] = c | attr;
+    unsigned old = cursor;
+    int c;
+
+    while (len--) {
+        c = *buf++ & 0xFF;
+
+        switch (c)
+        {
+        case 8: /* backspace */
+            if (cursor % COLS) --cursor;
+            break;
+        case '\n':
+            cursor += COLS;
+            break;
+        case '\r':
+            cursor -= (cursor % COLS);
+            break;
+        default:
+            vram[cursor++] = c | attr;
+        }
+
+        if (cursor >= (ROWS * COLS))    /* upward scroll */
+            scroll();
     }
 
-    if (cursor >= (ROWS * COLS)) {  /* upward scroll */
-        int i;
+    if (cursor != old) {
+        write_crtc(REG_CURSOR_ADDRHI, cursor >> 8);
+        write_crtc(REG_CURSOR_ADDRLO, cursor);
+    }
+}
 
-        for (i = COLS; i < (COLS * ROWS); ++i)
-            vram[i - COLS] = vram[i];
+/*
+ * printf() collects its output in a 'struct cbuf' and hands it to the
+ * kernel log in as few pieces as possible: usually one, at the end.
+ */
 
-        for (i = (COLS * (ROWS - 1)); i < (COLS * ROWS); ++i)
-            vram[i] = ' ' | attr;
+#define CBUF_SIZE 128
 
-        cursor -= COLS;
-    }
+struct cbuf
+{
+    int len;
+    char buf[CBUF_SIZE];
+};
 
-    write_crtc(REG_CURSOR_ADDRHI, cursor >> 8);
-    write_crtc(REG_CURSOR_ADDRLO, cursor);
+static
+flush(cb)
+struct cbuf *cb;
+{
+    if (cb->len) log_write(cb->buf, cb->len);
+    cb->len = 0;
+}
+
+static
+putc(cb, c)
+struct cbuf *cb;
+{
+    if (cb->len == CBUF_SIZE) flush(cb);
+    cb->buf[cb->len++] = c;
 }
 
 /*
@@ -109,10 +161,11 @@ putc(c)
 static char digits[] = "0123456789abcdef";
 
 static
-printn(n, base)
+printn(cb, n, base)
+struct cbuf *cb;
 unsigned long n;
 {
-    static char buf[MAX_DIGITS];
+    char buf[MAX_DIGITS];
     int pos = 0;
 
     do {
@@ -120,7 +173,7 @@ unsigned long n;
         n /= base;
     } while (n);
 
-    while (pos) putc(buf[--pos]);
+    while (pos) putc(cb, buf[--pos]);
 }
 
 /*
@@ -130,10 +183,12 @@ unsigned long n;
 printf(fmt)
 char *fmt;
 {
+    struct cbuf cb;
     va_list args;
     char *s;
     long n;
 
+    cb.len = 0;
     va_start(args, fmt);
 
     while (*fmt)
@@ -145,31 +200,32 @@ char *fmt;
             case 'd':
                 n = va_arg(args, int);
                 if (n < 0) {
-                    putc('-');
+                    putc(&cb, '-');
                     n = -n;
                 }
-                printn(n, 10);
+                printn(&cb, n, 10);
                 break;
             case 'x':
                 n = va_arg(args, unsigned);
-                printn(n, 16);
+                printn(&cb, n, 16);
                 break;
             case 's':
                 s = va_arg(args, char *);
-                while (*s) putc(*s++);
+                while (*s) putc(&cb, *s++);
                 break;
             default:
-                putc(*fmt);
+                putc(&cb, *fmt);
             }
         } else {
-            if (*fmt == '\n') putc('\r');
-            putc(*fmt);
+            if (*fmt == '\n') putc(&cb, '\r');
+            putc(&cb, *fmt);
         }
 
         ++fmt;
     }
 
     va_end(args);
+    flush(&cb);
 }
 
 /*
@@ -199,6 +255,8 @@ cons_init()
 
     for (i = 0; i < (ROWS * COLS); ++i)
         vram[i] = (vram[i] & 0x00FF) | attr;
+
+    log_sink(cons_write);
 }
 
 /* vi: set ts=4 expandtab: */
@@ -24,6 +24,10 @@
 
 ; MSRS
 
+IA32_EFER=0xC0000080
+IA32_STAR=0xC0000081
+IA32_LSTAR=0xC0000082
+IA32_FMASK=0xC0000084
 IA32_GS_BASE=0xC0000101
 IA32_KERNEL_GS_BASE=0xC0000102
 
@@ -32,6 +36,15 @@ IA32_KERNEL_GS_BASE=0xC0000102
 TSS_RSP0=0
 TSS_THIS=104
 TSS_CURPROC=112
+TSS_USER_RSP=120
+
+; offsets into 'struct boot'
+
+BOOT_TSS=0
+BOOT_TR=8
+BOOT_PROC=16
+BOOT_SIZE=512
+BOOT_SHIFT=9
 
 ; offsets in 'struct proc'
 
@@ -52,5 +65,6 @@ PROC_R15=104
 PROC_RFLAGS=112
 PROC_RIP=120
 PROC_FXSAVE=128
+PROC_PCID=640
 
 ; vi: set ts=4 expandtab:
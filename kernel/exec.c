@@ -0,0 +1,197 @@
+/* Copyright (c) 2019 Charles E. Youse (charles@gnuless.org).
+   All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "../include/stddef.h"
+#include "../include/a.out.h"
+#include "../include/sys/types.h"
+#include "../include/sys/queue.h"
+#include "../include/sys/param.h"
+#include "../include/sys/page.h"
+#include "../include/sys/sched.h"
+#include "../include/sys/proc.h"
+#include "../include/sys/seg.h"
+#include "../include/sys/vm.h"
+#include "../include/sys/exec.h"
+
+/* the page caches and reference counts of images are protected by
+   TOKEN_IMAGE. it isn't held while a page is read, though: page_alloc()
+   and image->read() can sleep, which lets it go. so if several processes
+   fault on a page at once, each may read it; the first to finish caches
+   its copy, and the others discard theirs in favor of it. */
+
+/* return the page at 'offset' in 'image', reading it into the page cache
+   if it isn't already there, with a reference taken for the caller. returns
+   0 if the page can't be read. page 0 may be read before the header is
+   known; that's fine, since the header is in the (page-padded) text. */
+
+pgno_t
+image_page(image, offset)
+struct image *image;
+unsigned long offset;
+{
+    unsigned long end;
+    token_t tokens;
+    pgno_t pgno;
+    char *page;
+    int index;
+
+    index = offset >> PAGE_SHIFT;
+    if (index >= NR_IMAGE_PAGES) return 0;
+    offset = ((unsigned long) index) << PAGE_SHIFT;
+
+    tokens = acquire(TOKEN_IMAGE);
+    pgno = image->pages[index];
+
+    if (pgno == 0) {
+        pgno = page_alloc(PMAP_IMAGE, image);
+        page = (char *) PGNO_TO_ADDR(pgno);
+
+        if (image->read(image, offset, page) == -1) {
+            page_release(pgno);
+            release(tokens);
+            return 0;
+        }
+
+        /* whatever follows the data in the file (the symbol table) must
+           not show up in the process: the bss begins there, zero-filled */
+
+        if (image->exec.a_magic == A_MAGIC) {
+            end = image->exec.a_text + image->exec.a_data;
+            if (end < offset) end = offset;
+            if (end < (offset + PAGE_SIZE))
+                bzero(page + (end - offset), offset + PAGE_SIZE - end);
+        }
+
+        if (image->pages[index]) {
+            page_release(pgno);
+            pgno = image->pages[index];
+        } else
+            image->pages[index] = pgno;
+    }
+
+    page_ref(pgno);
+    release(tokens);
+    return pgno;
+}
+
+/* take a reference to 'image' on behalf of a vm_region */
+
+image_ref(image)
+struct image *image;
+{
+    token_t tokens;
+
+    tokens = acquire(TOKEN_IMAGE);
+    ++image->refs;
+    release(tokens);
+}
+
+/* drop a reference to 'image'. when nothing maps it anymore, the page
+   cache is emptied: the pages are freed as soon as no process has them. */
+
+image_unref(image)
+struct image *image;
+{
+    token_t tokens;
+    int i;
+
+    tokens = acquire(TOKEN_IMAGE);
+
+    if (--image->refs == 0) {
+        for (i = 0; i < NR_IMAGE_PAGES; ++i) {
+            if (image->pages[i]) {
+                page_release(image->pages[i]);
+                image->pages[i] = 0;
+            }
+        }
+    }
+
+    release(tokens);
+}
+
+/* replace the user address space of 'proc' with 'image': text, data and
+   bss regions, and a stack at the top of user space. only the header
+   is read now; everything else is faulted in on demand. on success, returns
+   0 and stores the entry point in '*entry', leaving the actual transfer to
+   user mode to the caller. returns -1 if the image is unusable, in which
+   case the address space is untouched. 'proc' must be the current process,
+   or one that hasn't run yet (see spawn()). */
+
+image_load(proc, image, entry)
+struct proc *proc;
+struct image *image;
+unsigned long *entry;
+{
+    struct exec *hdr = &image->exec;
+    unsigned long text, data, bss;
+    token_t tokens;
+    pgno_t pgno;
+
+    tokens = acquire(TOKEN_IMAGE);
+
+    if (hdr->a_magic != A_MAGIC) {
+        pgno = image_page(image, 0L);
+
+        if (pgno) {
+            bcopy(PGNO_TO_ADDR(pgno), hdr, sizeof(*hdr));
+            page_release(pgno);
+        }
+    }
+
+    release(tokens);
+
+    if (hdr->a_magic != A_MAGIC) return -1;
+    if (hdr->a_text & (PAGE_SIZE - 1)) return -1;
+
+    text = hdr->a_text;
+    data = (hdr->a_data + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1L);
+    bss = ((hdr->a_data + hdr->a_bss + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1L))
+          - data;
+
+    if ((text + data) > (NR_IMAGE_PAGES * PAGE_SIZE)) return -1;
+
+    vm_unmap(proc, USER_BASE, USER_TOP - USER_BASE);
+    vm_map(proc, USER_BASE, text, 0, image, 0L);
+    if (data) vm_map(proc, USER_BASE + text, data, VM_W, image, text);
+    if (bss) vm_map(proc, USER_BASE + text + data, bss, VM_W, NULL, 0L);
+    vm_map(proc, USER_TOP - PAGE_SIZE, PAGE_SIZE, VM_W | VM_STACK,
+           NULL, 0L);
+
+    /* a_entry only has room for the low 32 bits of the address; images
+       are linked at USER_BASE, whose low 32 bits are zero, so add it back */
+
+    *entry = USER_BASE + hdr->a_entry;
+    return 0;
+}
+
+/* image_load() into the current process */
+
+image_exec(image, entry)
+struct image *image;
+unsigned long *entry;
+{
+    return image_load(this()->curproc, image, entry);
+}
+
+/* vi: set ts=4 expandtab: */
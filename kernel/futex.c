@@ -0,0 +1,143 @@
+/* Copyright (c) 2019 Charles E. Youse (charles@gnuless.org).
+   All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "../include/stddef.h"
+#include "../include/sys/types.h"
+#include "../include/sys/queue.h"
+#include "../include/sys/param.h"
+#include "../include/sys/page.h"
+#include "../include/sys/slab.h"
+#include "../include/sys/sched.h"
+#include "../include/sys/proc.h"
+#include "../include/sys/seg.h"
+#include "../include/sys/vm.h"
+#include "../include/sys/futex.h"
+
+/* a thread in futex_wait() is represented by a futex_waiter, queued on the
+   futexq[] bucket given by hashing its key. the queues are protected by
+   TOKEN_FUTEX. (the waiters can't live on the kernel stacks of the threads,
+   which aren't visible from other address spaces sharing the bucket.) */
+
+#define NR_FUTEXQS      64      /* must be a power of two */
+
+#define FUTEXQ(vm, addr) \
+    (((((unsigned long) (vm)) >> 6) ^ ((addr) >> 2)) & (NR_FUTEXQS - 1))
+
+struct futex_waiter
+{
+    struct vmspace *vm;         /* key: address space.. */
+    unsigned long addr;         /* ..and user address */
+    int woken;                  /* set by futex_wake() */
+
+    TAILQ_ENTRY(futex_waiter) links;    /* futexq[] */
+};
+
+static TAILQ_HEAD(, futex_waiter) futexq[NR_FUTEXQS];
+
+static struct slab futex_slab = SLAB_INITIALIZER(futex_slab,
+                                                 sizeof(struct futex_waiter));
+
+futex_init()
+{
+    int q;
+
+    for (q = 0; q < NR_FUTEXQS; ++q) TAILQ_INIT(&futexq[q]);
+}
+
+/* block the current thread until futex_wake() is called on the int at user
+   address 'addr', provided that it still contains 'expected'. returns 0
+   when woken, or -1 immediately if 'addr' is bad or the value differs.
+
+   the waiter is queued before the value is read: reading it may fault,
+   and acquiring the tokens to resolve that may drop TOKEN_FUTEX for a time.
+   a wake which follows a change to the value will still find us queued. */
+
+futex_wait(addr, expected)
+unsigned long addr;
+{
+    struct proc *proc = this()->curproc;
+    struct futex_waiter *waiter;
+    token_t tokens;
+    int woken;
+    int q;
+
+    if (addr & (sizeof(int) - 1)) return -1;
+
+    waiter = (struct futex_waiter *) slab_alloc(&futex_slab);
+    waiter->vm = proc->vm;
+    waiter->addr = addr;
+    waiter->woken = 0;
+    q = FUTEXQ(waiter->vm, addr);
+
+    tokens = acquire(TOKEN_VM | TOKEN_FUTEX);
+
+    if (vm_mapped(proc, addr, (unsigned long) sizeof(int))) {
+        TAILQ_INSERT_TAIL(&futexq[q], waiter, links);
+
+        if (*((int *) addr) == expected)
+            while (!waiter->woken) sleep(waiter, 0);
+        else if (!waiter->woken)
+            TAILQ_REMOVE(&futexq[q], waiter, links);
+    }
+
+    woken = waiter->woken;
+    release(tokens);
+    slab_free(waiter);
+
+    return woken ? 0 : -1;
+}
+
+/* wake up to 'n' threads waiting on the int at user address 'addr' in the
+   current address space, oldest first. returns the number woken. */
+
+futex_wake(addr, n)
+unsigned long addr;
+{
+    struct vmspace *vm = this()->curproc->vm;
+    struct futex_waiter *waiter;
+    struct futex_waiter *next;
+    token_t tokens;
+    int count = 0;
+    int q;
+
+    q = FUTEXQ(vm, addr);
+    tokens = acquire(TOKEN_FUTEX);
+
+    for (waiter = TAILQ_FIRST(&futexq[q]); waiter; waiter = next) {
+        if (count == n) break;
+        next = TAILQ_NEXT(waiter, links);
+
+        if ((waiter->vm == vm) && (waiter->addr == addr)) {
+            TAILQ_REMOVE(&futexq[q], waiter, links);
+            waiter->woken = 1;
+            wakeup(waiter);
+            ++count;
+        }
+    }
+
+    release(tokens);
+    return count;
+}
+
+/* vi: set ts=4 expandtab: */
@@ -0,0 +1,226 @@
+/* Copyright (c) 2019 Charles E. Youse (charles@gnuless.org).
+   All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "../include/stddef.h"
+#include "../include/sys/types.h"
+#include "../include/sys/param.h"
+#include "../include/sys/queue.h"
+#include "../include/sys/page.h"
+#include "../include/sys/sched.h"
+#include "../include/sys/proc.h"
+#include "../include/sys/acpi.h"
+#include "../include/sys/clock.h"
+
+/* the HPET is a free-running 64-bit counter with a fixed period, and a
+   number of comparators that raise an interrupt when it reaches them. we
+   use the counter as a fallback clocksource (see nanotime()) and to time
+   calibration, and comparator 0 for one-shot events via hpet_oneshot(). */
+
+#define HPET_READ(r)    (*((unsigned long *) (hpet_base + (r))))
+#define HPET_WRITE(r,v) (*((unsigned long *) (hpet_base + (r))) = (v))
+
+#define HPET_CAP        0x000       /* general capabilities and ID */
+#define HPET_CONF       0x010       /* general configuration */
+#define HPET_ISR        0x020       /* general interrupt status */
+#define HPET_COUNT      0x0F0       /* main counter */
+#define HPET_TCONF(n)   (0x100 + ((n) * 0x20))  /* timer n config/caps */
+#define HPET_TCMP(n)    (0x108 + ((n) * 0x20))  /* timer n comparator */
+
+#define HPET_CAP_64BIT      0x0000000000002000L     /* 64-bit counter */
+#define HPET_CAP_PERIOD(x)  (((x) >> 32) & 0xFFFFFFFF)  /* femtoseconds */
+#define HPET_CONF_ENABLE    0x0000000000000001L     /* counter runs */
+#define HPET_CONF_LEGACY    0x0000000000000002L     /* legacy routing */
+#define HPET_TCONF_LEVEL    0x0000000000000002L     /* level-triggered */
+#define HPET_TCONF_ENABLE   0x0000000000000004L     /* interrupt enabled */
+#define HPET_TCONF_PERIODIC 0x0000000000000008L     /* periodic mode */
+#define HPET_TCONF_64BIT    0x0000000000000020L     /* 64-bit comparator */
+#define HPET_TCONF_32MODE   0x0000000000000100L     /* force 32-bit mode */
+#define HPET_TCONF_ROUTE(p) (((long) (p)) << 9)     /* I/O APIC pin */
+#define HPET_TCONF_FSB      0x0000000000004000L     /* FSB (MSI) delivery */
+#define HPET_TCONF_CAPS(x)  (((x) >> 32) & 0xFFFFFFFF)  /* routable pins */
+
+#define HPET_PERIOD_MAX     100000000L  /* fs; 10ns, per the spec */
+#define HPET_MIN_DELTA      16          /* counts; to arm comparator safely */
+
+unsigned long hpet_period;      /* counter period in fs, 0 = no HPET */
+
+static char *hpet_base;         /* registers (identity-mapped) */
+static unsigned long hpet_mult; /* ns per count, << 32 */
+static unsigned long hpet_zero; /* counter value at hpet_init() */
+static int hpet_pin = -1;       /* I/O APIC pin for timer 0, -1 = none */
+
+/* the pending one-shot event: call 'event_fn' once the counter reaches
+   'event_count'. protected by the scheduler spinlock, since the interrupt
+   may be delivered to any CPU. */
+
+static int (*event_fn)();
+static unsigned long event_count;
+
+/* called by the BSP after acpi_init(): map the HPET, if there is one, and
+   start its counter. the counter must be 64 bits, or it would wrap too
+   often to be useful as a clocksource; all modern chipsets (and QEMU)
+   oblige. timer 0 is routed to the first I/O APIC pin it supports. */
+
+hpet_init()
+{
+    unsigned long addr;
+    unsigned long cap;
+    unsigned long tconf;
+    unsigned long period;
+    pte_t *pte;
+
+    if ((hpet == NULL) || (hpet->space != HPET_SPACE_MEMORY)) return;
+
+    addr = hpet->addr_lo | (((unsigned long) hpet->addr_hi) << 32);
+    if ((addr == 0) || (addr >= PHYSMAX)) return;
+
+    /* page_pte() hands back the PDPE if page_init_1gb() mapped this GB,
+       or the 2MB PDE apic_init() made if the HPET shares one with an APIC.
+       either way, it's already identity-mapped: leave it be. */
+
+    pte = page_pte(&proc0, addr, PTE_P | PTE_2MB);
+    if (!(*pte & PTE_P))
+        *pte = (addr & ~(PTE_2MB_SIZE - 1)) | PTE_2MB | PTE_W | PTE_P;
+    hpet_base = (char *) addr;
+
+    cap = HPET_READ(HPET_CAP);
+    period = HPET_CAP_PERIOD(cap);
+
+    if (!(cap & HPET_CAP_64BIT) || (period == 0)
+      || (period > HPET_PERIOD_MAX))
+        return;
+
+    HPET_WRITE(HPET_CONF, HPET_READ(HPET_CONF)
+                          & ~(HPET_CONF_ENABLE | HPET_CONF_LEGACY));
+
+    tconf = HPET_READ(HPET_TCONF(0));
+    tconf &= ~(HPET_TCONF_LEVEL | HPET_TCONF_ENABLE | HPET_TCONF_PERIODIC
+               | HPET_TCONF_32MODE | HPET_TCONF_ROUTE(0x1F) | HPET_TCONF_FSB);
+
+    if (tconf & HPET_TCONF_64BIT) {
+        hpet_pin = bsf(HPET_TCONF_CAPS(tconf));
+
+        if (hpet_pin != -1) {
+            tconf |= HPET_TCONF_ROUTE(hpet_pin) | HPET_TCONF_ENABLE;
+            ioapic_configure(hpet_pin, VECTOR_HPET, 0);
+        }
+    }
+
+    HPET_WRITE(HPET_TCONF(0), tconf);
+    HPET_WRITE(HPET_TCMP(0), -1L);
+    HPET_WRITE(HPET_COUNT, 0L);
+    HPET_WRITE(HPET_CONF, HPET_READ(HPET_CONF) | HPET_CONF_ENABLE);
+
+    hpet_mult = (period << 32) / 1000000L;
+    hpet_zero = HPET_READ(HPET_COUNT);
+    hpet_period = period;
+
+    if (hpet_pin != -1) ioapic_enable(hpet_pin);
+}
+
+/* return the raw value of the main counter */
+
+unsigned long
+hpet_count()
+{
+    return HPET_READ(HPET_COUNT);
+}
+
+/* return nanoseconds since hpet_init(). only valid if 'hpet_period' */
+
+unsigned long
+hpet_ns()
+{
+    return fixmul(HPET_READ(HPET_COUNT) - hpet_zero, hpet_mult);
+}
+
+/* arrange for fn() to be called, at interrupt time, 'ns' nanoseconds from
+   now. there's only one comparator in use, so only one event can be pending;
+   returns 0 if one already is, or if the HPET can't deliver interrupts. if
+   the deadline slips by while we're arming the comparator, we call fn()
+   ourselves rather than wait for a wraparound. fn() should be brief:
+   wakeup() something or other, and nothing more. */
+
+hpet_oneshot(ns, fn)
+unsigned long ns;
+int (*fn)();
+{
+    unsigned long delta;
+    unsigned long count;
+    int late;
+
+    if ((hpet_period == 0) || (hpet_pin == -1)) return 0;
+
+    /* divide first: 'ns * 1000000' would overflow after ~5 hours */
+
+    delta = (ns / hpet_period) * 1000000L
+            + ((ns % hpet_period) * 1000000L) / hpet_period;
+    if (delta < HPET_MIN_DELTA) delta = HPET_MIN_DELTA;
+
+    spin();
+
+    if (event_fn) {
+        unspin();
+        return 0;
+    }
+
+    event_fn = fn;
+    event_count = HPET_READ(HPET_COUNT) + delta;
+    HPET_WRITE(HPET_TCMP(0), event_count);
+
+    count = HPET_READ(HPET_COUNT);
+    late = ((long) (count - event_count)) >= 0;
+    if (late) event_fn = NULL;
+
+    unspin();
+
+    if (late) fn();
+    return 1;
+}
+
+/* called from locore on VECTOR_HPET. the interrupt may be stale, left over
+   from an event that hpet_oneshot() had to fire itself, so we only call
+   the event function if its deadline has actually passed. */
+
+hpet_intr()
+{
+    int (*fn)();
+
+    fn = NULL;
+    spin();
+
+    if (event_fn
+      && (((long) (HPET_READ(HPET_COUNT) - event_count)) >= 0))
+    {
+        fn = event_fn;
+        event_fn = NULL;
+    }
+
+    unspin();
+    lapic_eoi();
+
+    if (fn) fn();
+}
+
+/* vi: set ts=4 expandtab: */
@@ -82,8 +82,21 @@ _resume:        mov rdx, qword [rsp, 8]             ; 'proc'
                 cli ; atomic context switch
 
                 mov rsp, qword [rdx, PROC_RSP]
-                mov rax, qword [rdx, PROC_CR3]
-                mov cr3, rax
+
+                ; threads of the same process share CR3 (and PCID):
+                ; don't reload it needlessly when switching between
+                ; them. bit 63 (CR3_NOFLUSH) never reads back as set.
+
+                mov rcx, qword [rdx, PROC_CR3]
+                or rcx, qword [rdx, PROC_PCID]      ; see tlb_switch()
+                shl rcx, 1
+                shr rcx, 1
+                mov rax, cr3
+                cmp rax, rcx
+                jz _resume_samecr3
+                or rcx, qword [rdx, PROC_PCID]
+                mov cr3, rcx
+_resume_samecr3:
 
                 seg gs
                 mov qword [TSS_CURPROC], rdx
@@ -143,6 +156,112 @@ _this:          seg gs
                 mov rax, qword [TSS_THIS]
                 ret
 
+; cpuid(leaf, subleaf, regs) unsigned regs[4];
+; execute CPUID and store the resulting EAX, EBX, ECX, EDX in regs[0..3]
+
+.global _cpuid
+_cpuid:         push rbx
+                mov eax, dword [rsp, 16]    ; 'leaf'
+                mov ecx, dword [rsp, 24]    ; 'subleaf'
+                cpuid
+                push rdx
+                mov rdx, qword [rsp, 40]    ; 'regs'
+                mov dword [rdx], eax
+                mov dword [rdx, 4], ebx
+                mov dword [rdx, 8], ecx
+                pop rax
+                mov dword [rdx, 12], eax
+                pop rbx
+                ret
+
+; cr4_set(bits) long bits; - set 'bits' in CR4 of this CPU
+
+.global _cr4_set
+_cr4_set:       mov rax, cr4
+                or rax, qword [rsp, 8]      ; 'bits'
+                mov cr4, rax
+                ret
+
+; tlb_flush_all() - flush this CPU's TLB entirely: global or not, all PCIDs.
+; toggling CR4.PGE is the architectural way to do this without INVPCID.
+
+.global _tlb_flush_all
+_tlb_flush_all: pushfq
+                cli
+                mov rax, cr4
+                xor rax, 0x80               ; CR4.PGE
+                mov cr4, rax
+                xor rax, 0x80
+                mov cr4, rax
+                popfq
+                ret
+
+; unsigned long rdtsc() - return the time-stamp counter
+
+.global _rdtsc
+_rdtsc:         rdtsc
+                shl rdx, 32
+                or rax, rdx
+                ret
+
+; unsigned long rdmsr(msr) - return the value of model-specific register 'msr'
+
+.global _rdmsr
+_rdmsr:         mov ecx, dword [rsp, 8]     ; 'msr'
+                rdmsr
+                shl rdx, 32
+                or rax, rdx
+                ret
+
+; wrmsr(msr, v) unsigned long v; - write 'v' to model-specific register 'msr'
+
+.global _wrmsr
+_wrmsr:         mov ecx, dword [rsp, 8]     ; 'msr'
+                mov eax, dword [rsp, 16]    ; 'v' (low)
+                mov edx, dword [rsp, 20]    ; 'v' (high)
+                wrmsr
+                ret
+
+; unsigned long fixmul(a, b) unsigned long a, b;
+; fixed-point multiply: returns (a * b) >> 32, with a 128-bit intermediate
+
+.global _fixmul
+_fixmul:        mov rax, qword [rsp, 8]     ; 'a'
+                mul qword [rsp, 16]         ; 'b'
+                shr rax, 32
+                shl rdx, 32
+                or rax, rdx
+                ret
+
+; invlpg(addr) char *addr; - invalidate TLB entry for 'addr' (current PCID)
+
+.global _invlpg
+_invlpg:        mov rax, qword [rsp, 8]     ; 'addr'
+                invlpg byte [rax]
+                ret
+
+; unsigned long cr2() - return the faulting address of the last page fault
+
+.global _cr2
+_cr2:           mov rax, cr2
+                ret
+
+; tlb_flush() - flush this CPU's non-global TLB entries for the current PCID.
+; (reading CR3 yields the current PCID with CR3_NOFLUSH clear.)
+
+.global _tlb_flush
+_tlb_flush:     mov rax, cr3
+                mov cr3, rax
+                ret
+
+; pause() - a spin-wait hint. calling it in a polling loop also prevents
+; the compiler from caching the polled memory in a register (until it
+; supports 'volatile').
+
+.global _pause
+_pause:         pause
+                ret
+
 ; inb(port) - read byte from I/O port
 
 .global _inb
@@ -211,13 +211,13 @@ restart32:      mov ax, 0x10                    ; 32-bit data selectors
                 or eax, 0x220
                 mov cr4, eax
 
-                mov ecx, 0xc0000080             ; enable long mode in EFER
-                rdmsr
-                or eax, 0x100
+                mov ecx, IA32_EFER              ; enable long mode
+                rdmsr                           ; and SYSCALL in EFER
+                or eax, 0x101
                 wrmsr
 
-                mov eax, cr0                    ; enable paging
-                or eax, 0x80000000
+                mov eax, cr0                    ; enable paging, and
+                or eax, 0x80010000              ; write-protect in ring 0
                 mov cr0, eax
                 jmpf restart64, 0x18
 .bits 64
@@ -228,35 +228,74 @@ restart64:      xor eax, eax                    ; data segments are null
                 mov fs, ax
                 mov gs, ax
 
+                ; find our bootstrap block. the BSP's is fixed, and it stays on
+                ; the trampoline stack; each AP claims the next in boot_cpus[]
+                ; and moves to the stack in it. the kernel is below 4GB.
+
+                mov ebx, boot_bsp
+                cmp dword [_boot_nr], 0
+                jz restart64_2
+
+restart64_1:    lock
+                bts dword [boot_lock], 0
+                jc restart64_1
+                mov eax, dword [boot_next]
+                inc dword [boot_next]
+                mov dword [boot_lock], 0
+
+                shl rax, BOOT_SHIFT
+                mov ebx, _boot_cpus
+                add rbx, rax
+                mov rsp, rbx
+                add rsp, BOOT_SIZE
+
                 ; load per-CPU registers: TSS and GS base registers
 
-                mov ax, word [_boot_tr]
+restart64_2:    mov ax, word [rbx, BOOT_TR]
                 ltr ax
 
-                mov eax, dword [_boot_tss]
-                mov edx, dword [_boot_tss+4]
+                mov eax, dword [rbx, BOOT_TSS]
+                mov edx, dword [rbx, BOOT_TSS+4]
                 mov ecx, IA32_GS_BASE
                 wrmsr
                 mov ecx, IA32_KERNEL_GS_BASE
                 wrmsr
 
-                push qword [_boot_proc]
+                ; SYSCALL enters at syscall_entry with CS=0x18 and SS=0x20, and
+                ; SYSRET returns to CS=0x30|3 and SS=0x28|3 (see the GDT).
+                ; the kernel is below 4GB, so the high dword of LSTAR is 0.
+                ; FMASK clears TF, DF, IF, IOPL, NT and AC on entry.
+
+                mov ecx, IA32_STAR
+                xor eax, eax
+                mov edx, 0x00200018
+                wrmsr
+                mov ecx, IA32_LSTAR
+                mov eax, syscall_entry
+                xor edx, edx
+                wrmsr
+                mov ecx, IA32_FMASK
+                mov eax, 0x47700
+                wrmsr
+
+                push qword [rbx, BOOT_PROC]
                 call qword [_boot_entry]        ; and enter kernel!
                 cli                             ; should never return ..
 whoops:         jmp whoops
 
 .global _main
 .global _boot_entry
-.global _boot_proc
-.global _boot_tss
-.global _boot_tr
-.global _boot_flag
+.global _boot_cpus
+.global _boot_nr
 .align 8
 _boot_entry:    .qword _main
-_boot_proc:     .qword 0
-_boot_tss:      .qword _tss0
-_boot_tr:       .word 0x38
-_boot_flag:     .byte 0
+boot_bsp:       .qword _tss0                    ; struct boot for BSP
+                .qword 0x38
+                .qword 0
+                .qword 0
+_boot_nr:       .dword 0
+boot_next:      .dword 0                        ; next boot_cpus[] to claim
+boot_lock:      .dword 0
 
 ;
 ; error - report an error and halt.
@@ -366,16 +405,16 @@ _gdt:           .word 0, 0, 0, 0        ; null descriptor
                 .word 0x9200
                 .word 0x0000
 
-                .word 0                 ; 0x28 - 64-bit user code (0x2B)
-                .word 0
-                .word 0xF800
-                .word 0x0020
-
-                .word 0                 ; 0x30 - 64-bit user data (0x33)
+                .word 0                 ; 0x28 - 64-bit user data (0x2B)
                 .word 0
                 .word 0xF200
                 .word 0
 
+                .word 0                 ; 0x30 - 64-bit user code (0x33)
+                .word 0                 ; (SYSRET needs data, then code)
+                .word 0xF800
+                .word 0x0020
+
                 .word 0x0FFF            ; 0x38 - 64-bit TSS selector for CPU0
                 .word tss0
                 .word 0x8900
@@ -520,8 +559,8 @@ idt:    ; processor-defined traps
         ; miscellaneous system vectors here
 
         .word tick, 0x18, 0x8e00, 0, 0, 0, 0, 0         ; VECTOR_TICK
-        .word 0, 0, 0, 0, 0, 0, 0, 0                    ; 0xF1
-        .word 0, 0, 0, 0, 0, 0, 0, 0                    ; 0xF2
+        .word tlb, 0x18, 0x8e00, 0, 0, 0, 0, 0          ; VECTOR_TLB
+        .word hpet, 0x18, 0x8e00, 0, 0, 0, 0, 0         ; VECTOR_HPET
         .word 0, 0, 0, 0, 0, 0, 0, 0                    ; 0xF3
         .word 0, 0, 0, 0, 0, 0, 0, 0                    ; 0xF4
         .word 0, 0, 0, 0, 0, 0, 0, 0                    ; 0xF5
@@ -936,6 +975,18 @@ tick:           push 0
                 push 0
                 jmp vector
 
+.global _tlb_ipi
+tlb:            push 0
+                push _tlb_ipi
+                push 0
+                jmp vector
+
+.global _hpet_intr
+hpet:           push 0
+                push _hpet_intr
+                push 0
+                jmp vector
+
 .global _exit
 
 vector:         push rcx
@@ -965,6 +1016,65 @@ exit:           pop rbx
                 add rsp, 24                 ; discard number, handler, code
 spurious:       iretq
 
+; SYSCALL lands here from user mode, with the return RIP in rcx, the user
+; RFLAGS in r11, and interrupts off. the system call number is in rax, with
+; up to six arguments in rdi, rsi, rdx, r10, r8 and r9. the result is in
+; rax; only rcx and r11 (used by SYSCALL itself) are clobbered. the arguments
+; and number are pushed as a 'struct syscall' (see sys/syscall.h) for
+; syscall(), which does the dispatching.
+;
+; GS is swapped to reach the TSS, since we can't trust the user GS. then
+; IA32_KERNEL_GS_BASE is pointed back at the TSS: vector (above) relies on
+; it, should we be interrupted (or switched away from) before we return.
+
+.global _syscall
+
+syscall_entry:  swapgs
+                seg gs
+                mov qword [TSS_USER_RSP], rsp
+                seg gs
+                mov rsp, qword [TSS_RSP0]       ; this thread's kernel stack
+                seg gs
+                push qword [TSS_USER_RSP]
+                push rcx
+                push r11
+
+                push rax
+                push r9
+                push r8
+                push r10
+                push rdx
+                push rsi
+                push rdi
+
+                seg gs
+                mov eax, dword [TSS_THIS]
+                seg gs
+                mov edx, dword [TSS_THIS+4]
+                mov ecx, IA32_KERNEL_GS_BASE
+                wrmsr
+
+                sti
+                push rsp                        ; struct syscall *
+                call _syscall
+                add rsp, 8
+                mov qword [rsp, 48], rax        ; save result over number
+
+                call _exit                      ; "exiting to user mode"
+
+                cli
+                pop rdi
+                pop rsi
+                pop rdx
+                pop r10
+                pop r8
+                pop r9
+                pop rax
+                pop r11
+                pop rcx
+                pop rsp                         ; back on the user stack
+                sysretq
+
 ;
 ; TSS for CPU0; remember 'struct tss' is offset by 4
 ;
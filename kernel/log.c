@@ -0,0 +1,301 @@
+/* Copyright (c) 2019 Charles E. Youse (charles@gnuless.org).
+   All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "../include/stddef.h"
+#include "../include/sys/types.h"
+#include "../include/sys/param.h"
+#include "../include/sys/queue.h"
+#include "../include/sys/page.h"
+#include "../include/sys/sched.h"
+#include "../include/sys/proc.h"
+#include "../include/sys/seg.h"
+#include "../include/sys/clock.h"
+#include "../include/sys/log.h"
+
+/* messages longer than this are split into several records */
+
+#define LOG_MAX_TEXT    128
+
+static int (*sinks[NR_LOG_SINKS])();
+static int nr_sinks;
+
+/* non-zero once the log daemon is running (and until a panic). this is
+   also the channel the daemon sleeps on, waiting for log_tick(). */
+
+static int live;
+
+/* the daemon's view of the sinks: 'mid_line' if the last message written
+   didn't end its line, in which case 'last_cpu' wrote it. 'reported' is
+   the number of dropped messages already reported for each CPU. */
+
+static int mid_line;
+static int last_cpu;
+static unsigned long reported[NR_CPUS];
+static char dropped[] = " messages dropped\r\n";
+
+/* register a sink: fn(buf, len, sync) is called with every chunk of output.
+   'sync' is set when the sink must write immediately, without blocking: the
+   caller may be anywhere (before log_start(), say, or in a panic). */
+
+log_sink(fn)
+int (*fn)();
+{
+    if (nr_sinks < NR_LOG_SINKS) sinks[nr_sinks++] = fn;
+}
+
+static
+emit(buf, len)
+char *buf;
+{
+    int i;
+
+    for (i = 0; i < nr_sinks; ++i)
+        sinks[i](buf, len, !live);
+}
+
+/* copy 'len' bytes to/from a ring at free-running offset 'pos' */
+
+static
+ring_put(tss, pos, buf, len)
+struct tss *tss;
+unsigned long pos;
+char *buf;
+{
+    while (len--) tss->log_ring[pos++ & (LOG_RING - 1)] = *buf++;
+}
+
+static
+ring_get(tss, pos, buf, len)
+struct tss *tss;
+unsigned long pos;
+char *buf;
+{
+    while (len--) *buf++ = tss->log_ring[pos++ & (LOG_RING - 1)];
+}
+
+/* append a record to this CPU's ring. interrupts are disabled so an ISR on
+   the same CPU can't append in the middle, but that's all the locking it
+   needs: only this CPU advances the head, and only the daemon the tail.
+   (the daemon won't look at the record until the head moves past it, and
+   the compiler emits stores in order, as does the CPU.) */
+
+static
+append(buf, len)
+char *buf;
+{
+    struct logrec rec;
+    struct tss *tss;
+    unsigned long size;
+    long flags;
+
+    size = LOGREC_SIZE(len);
+    flags = lock();
+    tss = this();
+
+    if (((tss->log_head - tss->log_tail) + size) > LOG_RING)
+        ++tss->log_lost;
+    else {
+        rec.ns = nanotime();
+        rec.len = len;
+        rec.flags = tss->log_bol ? LOGREC_BOL : 0;
+        ring_put(tss, tss->log_head, &rec, sizeof(rec));
+        ring_put(tss, tss->log_head + sizeof(rec), buf, len);
+        tss->log_head += size;
+    }
+
+    tss->log_bol = (buf[len - 1] == '\n');
+    unlock(flags);
+}
+
+/* called by printf() with its output */
+
+log_write(buf, len)
+char *buf;
+{
+    int n;
+
+    if (!live) {
+        emit(buf, len);
+        return;
+    }
+
+    while (len > 0) {
+        n = (len > LOG_MAX_TEXT) ? LOG_MAX_TEXT : len;
+        append(buf, n);
+        buf += n;
+        len -= n;
+    }
+}
+
+/* format 'n' in decimal, right-justified in 'width' with 'pad' */
+
+static char *
+fmtnum(p, n, width, pad)
+char *p;
+unsigned long n;
+{
+    int i;
+
+    for (i = width - 1; i >= 0; --i) {
+        p[i] = '0' + (n % 10);
+        n /= 10;
+        if (n == 0) break;
+    }
+
+    while (--i >= 0) p[i] = pad;
+    return p + width;
+}
+
+/* write a message: 'text' from 'cpu', stamped 'ns'. each line gets a prefix
+   with the time and CPU. 'bol' is set if the message starts a line of its
+   own, per LOGREC_BOL. if the line left unfinished was another CPU's, or
+   the rest of it was dropped (so this one starts a new line), we break it
+   rather than splice the two together. */
+
+static
+output(cpu, ns, text, len, bol)
+unsigned long ns;
+char *text;
+{
+    char prefix[32];
+    char *p;
+
+    if (mid_line && ((cpu != last_cpu) || bol)) {
+        emit("\r\n", 2);
+        mid_line = 0;
+    }
+
+    if (!mid_line) {
+        p = prefix;
+        *p++ = '[';
+        p = fmtnum(p, ns / 1000000000L, 5, ' ');
+        *p++ = '.';
+        p = fmtnum(p, (ns % 1000000000L) / 1000, 6, '0');
+        *p++ = ' ';
+        p = fmtnum(p, (long) cpu, 2, ' ');
+        *p++ = ']';
+        *p++ = ' ';
+        emit(prefix, p - prefix);
+    }
+
+    emit(text, len);
+    mid_line = (text[len - 1] != '\n');
+    last_cpu = cpu;
+}
+
+/* write out the oldest record in any ring. returns zero if there wasn't one.
+   along the way, report any messages that have been dropped. */
+
+static
+drain()
+{
+    struct logrec rec;
+    struct tss *tss;
+    struct tss *best;
+    unsigned long best_ns;
+    unsigned long lost;
+    char text[LOG_MAX_TEXT];
+    char *p;
+    int i;
+
+    best = NULL;
+
+    for (i = 0; i < nr_cpus; ++i) {
+        tss = cpus[i];
+        lost = tss->log_lost;
+
+        if (lost != reported[i]) {
+            p = fmtnum(text, lost - reported[i], 8, ' ');
+            bcopy(dropped, p, sizeof(dropped) - 1);
+            p += sizeof(dropped) - 1;
+            output(i, nanotime(), text, p - text, 1);
+            reported[i] = lost;
+        }
+
+        if (tss->log_head == tss->log_tail) continue;
+
+        ring_get(tss, tss->log_tail, &rec, sizeof(rec));
+
+        if ((best == NULL) || (rec.ns < best_ns)) {
+            best = tss;
+            best_ns = rec.ns;
+        }
+    }
+
+    if (best == NULL) return 0;
+
+    ring_get(best, best->log_tail, &rec, sizeof(rec));
+    ring_get(best, best->log_tail + sizeof(rec), text, rec.len);
+    best->log_tail += LOGREC_SIZE(rec.len);
+
+    output(best->cpu, rec.ns, text, rec.len, rec.flags & LOGREC_BOL);
+    return 1;
+}
+
+/* the log daemon: drain the rings, then sleep until log_tick() */
+
+static
+logd()
+{
+    for (;;) {
+        while (drain()) ;
+        sleep(&live, 0);
+    }
+}
+
+/* called on the BSP, once the scheduler is running, to start the daemon */
+
+log_start()
+{
+    if (thread_create(PRIORITY_USER, logd, NULL) != -1)
+        live = 1;
+}
+
+/* called on the BSP every tick: wake the daemon if there's work. messages
+   are thus delayed by a tick at most, but printf() itself never wakes it,
+   so it's safe to call from anywhere- with the spin lock held, even. */
+
+log_tick()
+{
+    int i;
+
+    if (!live) return;
+
+    for (i = 0; i < nr_cpus; ++i)
+        if (cpus[i]->log_head != cpus[i]->log_tail) {
+            wakeup(&live);
+            return;
+        }
+}
+
+/* called by panic(): write out what's in the rings, then go synchronous
+   so the panic message appears, whatever state the daemon is in. */
+
+log_panic()
+{
+    live = 0;
+    while (drain()) ;
+}
+
+/* vi: set ts=4 expandtab: */
@@ -22,90 +22,140 @@
  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
+#include "../include/stddef.h"
 #include "../include/a.out.h"
 #include "../include/sys/queue.h"
 #include "../include/sys/types.h"
+#include "../include/sys/param.h"
 #include "../include/sys/sched.h"
 #include "../include/sys/page.h"
 #include "../include/sys/seg.h"
 #include "../include/sys/acpi.h"
 #include "../include/sys/proc.h"
-#include "../include/sys/param.h"
 #include "../include/sys/clock.h"
+#include "../include/sys/vm.h"
+#include "../include/sys/futex.h"
+#include "../include/sys/log.h"
+#include "../include/sys/uart.h"
+
+struct boot boot_cpus[NR_CPUS];
 
-/* the APs enter here in their idle process contexts */
+/* the APs enter here in their idle process contexts. each reports in via
+   its bootstrap block, then waits for the BSP to number it in turn. the
+   BSP puts it in cpus[] as soon as it reports, so by then its local APIC
+   must be enabled and its 'apic_id' known, to receive IPIs. */
 
 static
 ap()
 {
-    boot_flag = 1;
+    struct boot *boot = (struct boot *) this()->curproc->arg;
+
+    lapic_init();
+    this()->apic_id = lapic_id();
+    topo_cpu();
+    boot->flag = 1;
+    clock_sync_ap();
 
     fpu_init();
+    tlb_init();
 
-    printf("AP %d started\n", lapic_id());
+    printf("AP %d started\n", this()->apic_id);
 
-    lapic_init();
     lapic_ticker();
 
     idle();
 }
 
-/* allocate a TSS and idle process for, and start, each AP in turn */
+/* intervals for the INIT-SIPI-SIPI sequence that starts the APs, and the
+   time we allow them to report in after that. */
+
+#define INIT_DELAY      10000000L       /* 10ms after INIT */
+#define SIPI_DELAY      200000L         /* 200us after each SIPI */
+#define AP_TIMEOUT      100000000L      /* 100ms */
+
+/* allocate a TSS, idle process and bootstrap block for each AP, and start
+   them all at once. a second SIPI is ignored by an AP the first started.
+   the APs claim the blocks in order, so we wait for them in that order,
+   numbering each as it comes up and synchronizing its TSC with ours. */
 
 static
 start_aps()
 {
-    int n;
-    struct madt_cpu *cpu;
+    unsigned ids[NR_CPUS];
+    struct boot *boot;
     struct tss *tss;
     struct proc *proc;
-    pgno_t pgno;
+    unsigned long addr;
     unsigned long desc;
+    unsigned long end;
+    pgno_t pgno;
+    int nr;
+    int i;
 
-    for (n = 0; cpu = acpi_cpu(n); ++n) {
-        if (cpu->id == lapic_id()) continue;
-        if (!(cpu->flags & MADT_CPU_ENABLED)) continue;
+    for (nr = 0, i = 0; i < nr_acpi_cpus; ++i) {
+        if (acpi_cpus[i] == this()->apic_id) continue;
+        if (!lapic_reachable(acpi_cpus[i])) continue;
+        if (nr == (NR_CPUS - 1)) break;
+
+        ids[nr] = acpi_cpus[i];
+        boot = &boot_cpus[nr++];
 
         /* allocate a page for the AP TSS */
 
         pgno = page_alloc(PMAP_KERNEL, 0);
-        boot_tss = PGNO_TO_ADDR(pgno);
+        addr = PGNO_TO_ADDR(pgno);
 
         /* create GDT selector for AP's TR */
 
-        desc = (boot_tss & 0x00FFFFFF)  << 16;
-        desc |= (boot_tss & 0xFF000000) << 32;
+        desc = (addr & 0x00FFFFFF)  << 16;
+        desc |= (addr & 0xFF000000) << 32;
         desc |= 0x0000890000000FFF;
-        boot_tr = gdt_alloc(desc);
-        gdt_alloc(boot_tss >> 32);
+        boot->tr = gdt_alloc(desc);
+        gdt_alloc(addr >> 32);
 
         /* initialize the TSS; remember we offset the struct */
 
-        boot_tss += 4;
-        tss = (struct tss *) boot_tss;
-        tss_init(tss);
+        boot->tss = addr + 4;
+        tss_init((struct tss *) boot->tss);
 
         /* now, allocate the AP's idle process with an entry point at
-           ap(), and set the AP to resume that process on boot-up. */
+           ap(), which the AP will resume on boot-up. */
 
         proc = proc_alloc();
         proc->cpu.rip = (long) ap;
-        boot_entry = resume;
-        boot_proc = proc;
+        proc->arg = (char *) boot;
+        boot->proc = proc;
+        boot->flag = 0;
+    }
+
+    if (nr == 0) return;
+
+    boot_entry = resume;
+    boot_nr = nr;
+
+    for (i = 0; i < nr; ++i) lapic_init_ipi(ids[i]);
+    delay(INIT_DELAY);
+    for (i = 0; i < nr; ++i) lapic_startup_ipi(ids[i], &exec);
+    delay(SIPI_DELAY);
+    for (i = 0; i < nr; ++i) lapic_startup_ipi(ids[i], &exec);
 
-        /* we start the APs synchronously because
-           they share the trampoline stack. */
+    end = nanotime() + AP_TIMEOUT;
 
-        boot_flag = 0;
-        lapic_startcpu(cpu->id, &exec);
+    for (i = 0; i < nr; ++i) {
+        boot = &boot_cpus[i];
 
-        while (boot_flag == 0) {
-            /* call a harmless function so the compiler doesn't hold the flag
-               in a register; change to 'volatile' when compiler supports it */
+        /* nanotime() is a function call, so the compiler won't hold the
+           flag in a register; change to 'volatile' when it supports it */
 
-            lapic_id();
-        }
+        while (!boot->flag && (nanotime() < end)) ;
+        if (!boot->flag) break;
+
+        tss = (struct tss *) boot->tss;
+        tss_online(tss);
+        clock_sync_bsp(tss);
     }
+
+    if (i < nr) printf("%d of %d APs didn't start\n", nr - i, nr);
 }
 
 /* the BSP re-starts here properly situated on a kernel stack as proc0 */
@@ -114,13 +164,25 @@ static
 bsp()
 {
     fpu_init();
+    tlb_init();
     apic_init();        /* disables all interrupt sources */
+    this()->apic_id = lapic_id();
+    acpi_init();
+    page_numa();        /* sort free pages by NUMA node, per the SRAT */
+    topo_cpu();         /* after acpi_init(), for our NUMA node */
+    hpet_init();        /* before lapic_ticker(), to calibrate */
     sched_init();       /* initialize scheduler qs/lock, enable interrupts */
+    futex_init();
     release(TOKEN_ALL); /* the scheduler is safe now */
     lapic_ticker();     /* so we can start scheduling ticks */
+    uart_start();
+    log_start();        /* printf() is asynchronous from here on */
 
-    acpi_init();
     start_aps();
+    topo_build();       /* now that all the CPUs are known */
+
+    if (fork(PRIORITY_USER) == 0)
+        reaper();
 
     idle();
 }
@@ -133,7 +195,9 @@ main()
     bzero(((char *) &exec) + exec.a_text + exec.a_data, exec.a_bss);
 
     tss_init(&tss0);
+    tss_online(&tss0);
     cons_init();
+    uart_init();
 
     printf("os/64 (compiled %s %s)\n", __DATE__, __TIME__);
     printf("[%d text, %d data, %d bss] @ 0x%x\n", exec.a_text, exec.a_data,
@@ -144,6 +208,9 @@ main()
        process0 holding ALL TOKENS so they don't try to schedule, though.)
        once memory is mapped, we can allocate a proper kernel stack */
 
+    vm_init(&vm0);
+    vm0.cr3 = proto_pml4;
+    proc0.vm = &vm0;
     proc_init(0, &proc0);
     proc0.cr3 = proto_pml4;
     proc0.cpu.rip = (long) bsp;
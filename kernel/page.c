@@ -31,11 +31,42 @@
 #include "../include/sys/sched.h"
 #include "../include/sys/clock.h"
 #include "../include/sys/proc.h"
+#include "../include/sys/seg.h"
+#include "../include/sys/tlb.h"
+#include "../include/sys/vm.h"
+#include "../include/sys/acpi.h"
 
-/* free pages are tracked by keeping their pmap[] entries on free_pages. */
+/* free pages are tracked by keeping their pmap[] entries on the free list
+   of their NUMA node. page_alloc() takes from the calling CPU's node when
+   it can, otherwise from the nearest node that has any: the first 'nodes'
+   entries of fallback[n * NR_NODES] are the nodes by distance from 'n'.
+   until page_numa() says otherwise, everything is on node 0. */
 
-static pgno_t nr_free_pages;
-static LIST_HEAD(, pmap) free_pages;
+static pgno_t nr_pages;             /* size of pmap[] */
+static pgno_t nr_free_pages;        /* on all nodes */
+static struct pmap_list free_pages[NR_NODES];
+static unsigned char fallback[NR_NODES * NR_NODES];
+static int nodes = 1;
+
+/* page_alloc_2mb() searches for free, aligned runs of pages starting from
+   where it left off last time, so it doesn't keep rescanning the same RAM.
+   it gives up after HUGE_SCAN runs, so a failed search (which is the norm
+   once RAM is fragmented) doesn't hold TOKEN_PMAP over all of pmap[]. */
+
+#define HUGE_SCAN   256             /* runs: 512MB */
+
+static pgno_t huge_next;
+
+/* put 'pg' on the free list of its node. the caller holds TOKEN_PMAP. */
+
+static
+free_page(pg)
+struct pmap *pg;
+{
+    pg->type = PMAP_FREE;
+    LIST_INSERT_HEAD(&free_pages[pg->node], pg, list);
+    ++nr_free_pages;
+}
 
 page_free(pgno)
 pgno_t pgno;
@@ -43,9 +74,7 @@ pgno_t pgno;
     token_t tokens;
 
     tokens = acquire(TOKEN_PMAP);
-    pmap[pgno].type = PMAP_FREE;
-    LIST_INSERT_HEAD(&free_pages, &pmap[pgno], list);
-    ++nr_free_pages;
+    free_page(&pmap[pgno]);
     release(tokens);
 }
 
@@ -58,23 +87,114 @@ long u;
 {
     token_t tokens;
     struct pmap *pg;
+    unsigned char *order;
+    int i;
 
     tokens = acquire(TOKEN_PMAP);
 
     while (nr_free_pages == 0)
         sleep(&time, 0);
 
-    pg = LIST_FIRST(&free_pages);
+    order = &fallback[this()->node * NR_NODES];
+    for (i = 0; i < nodes; ++i)
+        if (pg = LIST_FIRST(&free_pages[order[i]])) break;
+
     LIST_REMOVE(pg, list);
     --nr_free_pages;
     release(tokens);
 
     pg->type = type;
+    pg->refs = 1;
     pg->u.u = u;
     return (pgno_t) (pg - pmap);
 }
 
-/* allocate and initialize a new PTE page for the given process */
+/* take another reference to a page */
+
+page_ref(pgno)
+pgno_t pgno;
+{
+    token_t tokens;
+
+    tokens = acquire(TOKEN_PMAP);
+    ++pmap[pgno].refs;
+    release(tokens);
+}
+
+/* drop a reference to a page, freeing it if that was the last */
+
+page_release(pgno)
+pgno_t pgno;
+{
+    token_t tokens;
+
+    tokens = acquire(TOKEN_PMAP);
+    if (--pmap[pgno].refs == 0) page_free(pgno);
+    release(tokens);
+}
+
+/* allocate PTES_PER_TABLE physically-contiguous, 2MB-aligned pages for a
+   PTE_2MB mapping at 'vaddr' in a process. every page gets its own pmap[]
+   entry (and reference count) as usual, so the mapping can later be split
+   into 4K pages. returns the first page, or 0 if no such run is free. */
+
+pgno_t
+page_alloc_2mb(vaddr)
+unsigned long vaddr;
+{
+    token_t tokens;
+    pgno_t pgno;
+    pgno_t n;
+    int i;
+
+    tokens = acquire(TOKEN_PMAP);
+
+    if (nr_free_pages >= PTES_PER_TABLE) {
+        for (n = 0; (n < nr_pages) && (n < (HUGE_SCAN * PTES_PER_TABLE));
+          n += PTES_PER_TABLE)
+        {
+            pgno = huge_next;
+            huge_next += PTES_PER_TABLE;
+            if (huge_next >= nr_pages) huge_next = 0;
+            if ((pgno + PTES_PER_TABLE) > nr_pages) continue;
+
+            for (i = 0; i < PTES_PER_TABLE; ++i)
+                if (pmap[pgno + i].type != PMAP_FREE) break;
+
+            if (i == PTES_PER_TABLE) {
+                for (i = 0; i < PTES_PER_TABLE; ++i) {
+                    LIST_REMOVE(&pmap[pgno + i], list);
+                    pmap[pgno + i].type = PMAP_ANON;
+                    pmap[pgno + i].refs = 1;
+                    pmap[pgno + i].u.vaddr = vaddr + (i * PAGE_SIZE);
+                }
+
+                nr_free_pages -= PTES_PER_TABLE;
+                release(tokens);
+                return pgno;
+            }
+        }
+    }
+
+    release(tokens);
+    return 0;
+}
+
+/* return the run of PTES_PER_TABLE pages from page_alloc_2mb() at 'pgno',
+   unused, to the free lists. */
+
+page_free_2mb(pgno)
+pgno_t pgno;
+{
+    token_t tokens;
+    int i;
+
+    tokens = acquire(TOKEN_PMAP);
+    for (i = 0; i < PTES_PER_TABLE; ++i) free_page(&pmap[pgno + i]);
+    release(tokens);
+}
+
+/* allocate and initialize a new PTE page for the address space of 'proc' */
 
 pte_t *
 pte_alloc(proc)
@@ -83,8 +203,8 @@ struct proc *proc;
     pte_t *pte;
     pgno_t pgno;
 
-    pgno = page_alloc(PMAP_PTE, proc);
-    LIST_INSERT_HEAD(&proc->pte_pages, &pmap[pgno], list);
+    pgno = page_alloc(PMAP_PTE, proc->vm);
+    LIST_INSERT_HEAD(&proc->vm->pte_pages, &pmap[pgno], list);
     pte = (pte_t *) PGNO_TO_ADDR(pgno);
     bzero(pte, PAGE_SIZE);
     return pte;
@@ -98,21 +218,25 @@ struct proc *proc;
    PTE_2MB: return the page directory PTE (covers 2MB range)
    PTE_P: create any/all intermediate tables as necessary
 
-   if PTE_P is not given and there is no existing mapping, NULL is returned. */
+   if PTE_P is not given and there is no existing mapping, NULL is returned.
+   if 'vaddr' is mapped by a PTE_2MB page directory PTE (or a PTE_1GB page
+   directory-pointer PTE) that is returned regardless of 'flags', so callers
+   must be prepared to check for that. */
 
 pte_t *
 page_pte(proc, vaddr, flags)
 struct proc *proc;
 char *vaddr;
 {
-    pte_t *table = proc->cr3;
+    pte_t *table = proc->vm->cr3;
     int level = 3;
     pte_t *pte;
     pgno_t pgno;
 
     for (;;) {
         pte = &table[PTE_INDEX(vaddr, level)];
-        if ((level == 1) && (flags & PTE_2MB)) break;
+        if ((level == 2) && (*pte & PTE_1GB)) break;
+        if ((level == 1) && ((flags | *pte) & PTE_2MB)) break;
         if (level == 0) break;
 
         if (!(*pte & PTE_P)) {
@@ -143,7 +267,437 @@ char *vaddr;
     pte = page_pte(proc, vaddr, 0);
     if ((pte == NULL) || !(*pte & PTE_P)) return NULL;
 
-    return (char *) PTE_ADDR(*pte);
+    if (*pte & PTE_2MB)
+        return (char *) (PTE_ADDR(*pte) + PTE_2MB_OFFSET(vaddr));
+    else
+        return (char *) PTE_ADDR(*pte);
+}
+
+/* drop a reference to each of the 'count' pages starting at 'pg', moving
+   any whose last reference goes to 'list'. TOKEN_PMAP is held. */
+
+static
+page_unref(pg, count, list)
+struct pmap *pg;
+struct pmap_list *list;
+{
+    while (count--) {
+        if (--pg->refs == 0) LIST_INSERT_HEAD(list, pg, list);
+        ++pg;
+    }
+}
+
+/* replace the PTE_2MB mapping of 'vaddr' in 'proc' with a page table of
+   4K PTEs that map the same pages with the same permissions. the pages'
+   references are unaffected. the caller is responsible for flushing the
+   old entry (invalidating any 4K page within it is enough to do that).
+
+   pte_alloc() may sleep, and a sibling thread may split or unmap the 2MB
+   page meanwhile, so the entry is only looked at once the table is in
+   hand. returns 0 (having freed the table) if it's no longer a 2MB page,
+   in which case the caller must look again; non-zero if it was split. */
+
+static
+page_split(proc, vaddr)
+struct proc *proc;
+unsigned long vaddr;
+{
+    pte_t *table;
+    pte_t *pde;
+    struct pmap *pg;
+    unsigned long addr;
+    pte_t flags;
+    int i;
+
+    table = pte_alloc(proc);
+    pde = page_pte(proc, vaddr, PTE_2MB);
+
+    if ((pde == NULL) || ((*pde & (PTE_P | PTE_2MB)) != (PTE_P | PTE_2MB))) {
+        pg = &pmap[ADDR_TO_PGNO(table)];
+        LIST_REMOVE(pg, list);      /* from vm->pte_pages */
+        page_free(pg - pmap);
+        return 0;
+    }
+
+    addr = PTE_ADDR(*pde);
+    flags = PTE_FLAGS(*pde) & ~PTE_2MB;
+
+    for (i = 0; i < PTES_PER_TABLE; ++i)
+        table[i] = (addr + (i * PAGE_SIZE)) | flags;
+
+    *pde = ((long) table) | PTE_P | PTE_W | PTE_U;
+    return 1;
+}
+
+/* return all the pages on 'list' to the free list, under one acquisition
+   of TOKEN_PMAP. used by the reaper to free dead address spaces en masse. */
+
+page_free_list(list)
+struct pmap_list *list;
+{
+    token_t tokens;
+    struct pmap *pg;
+
+    tokens = acquire(TOKEN_PMAP);
+
+    while (pg = LIST_FIRST(list)) {
+        LIST_REMOVE(pg, list);
+        free_page(pg);
+    }
+
+    release(tokens);
+}
+
+/* strip the mapping in the PTE at 'pte', which is an entry in a table at
+   'level' that starts at 'vaddr'. pages released are moved onto 'list'
+   (shared pages only when their last reference goes). returns non-zero
+   if some part of the kernel stack is left mapped. TOKEN_PMAP is held. */
+
+static
+strip(pte, level, vaddr, keep, list)
+pte_t *pte;
+unsigned long vaddr;
+struct pmap_list *list;
+{
+    struct pmap *pg;
+    pte_t *table;
+    unsigned long size;
+    int left;
+    int i;
+
+    if (!(*pte & PTE_P)) return 0;
+    pg = &pmap[ADDR_TO_PGNO(PTE_ADDR(*pte))];
+
+    if (level == 0) {
+        if (keep && (vaddr >= (unsigned long) KSTACK_SLOT_BASE(0))) return 1;
+        page_unref(pg, 1, list);
+    } else if ((level == 1) && (*pte & PTE_2MB))
+        page_unref(pg, PTES_PER_TABLE, list);   /* never the kernel stack */
+    else {
+        table = (pte_t *) PTE_ADDR(*pte);
+        size = 1L << (((level - 1) * 9) + PAGE_SHIFT);
+        left = 0;
+
+        for (i = 0; i < PTES_PER_TABLE; ++i, vaddr += size)
+            left |= strip(&table[i], level - 1, vaddr, keep, list);
+
+        if (left) return 1;
+
+        LIST_REMOVE(pg, list);      /* from vm->pte_pages */
+        LIST_INSERT_HEAD(list, pg, list);
+    }
+
+    *pte = 0;
+    return 0;
+}
+
+/* tear down the address space of a dead 'proc' (whose threads are all
+   gone), moving the pages released onto 'list' for page_free_list(). if
+   'keep' is set, the kernel stack in slot 0 and the tables that map it are
+   left in place (so the proc can be recycled without rebuilding them);
+   otherwise the PML4 goes too. the kernel PML4E is skipped, of course. */
+
+page_strip(proc, keep, list)
+struct proc *proc;
+struct pmap_list *list;
+{
+    unsigned long vaddr;
+    struct pmap *pg;
+    token_t tokens;
+    int i;
+
+    tokens = acquire(TOKEN_PMAP);
+
+    for (i = 1; i < PTES_PER_TABLE; ++i) {
+        vaddr = (unsigned long) i << ((3 * 9) + PAGE_SHIFT);
+        if (i >= PTES_PER_TABLE / 2) vaddr |= 0xFFFF000000000000L;
+        strip(&proc->vm->cr3[i], 3, vaddr, keep, list);
+    }
+
+    release(tokens);
+
+    if (!keep) {
+        pg = LIST_FIRST(&proc->vm->pte_pages);
+        LIST_REMOVE(pg, list);
+        LIST_INSERT_HEAD(list, pg, list);
+    }
+}
+
+/* share the mapping in the PTE 'src' of the parent with the PTE 'dst' of
+   'child'; both are entries in tables at 'level' that start at 'vaddr'.
+   writeable pages become read-only and PTE_COW in both, and are added to
+   the parent's 'batch' to be flushed. TOKEN_PMAP is held. */
+
+static
+cow(child, src, dst, level, vaddr, batch)
+struct proc *child;
+pte_t *src;
+pte_t *dst;
+unsigned long vaddr;
+struct tlb_batch *batch;
+{
+    pte_t *src_table;
+    pte_t *dst_table;
+    unsigned long size;
+    struct pmap *pg;
+    int count;
+    int i;
+
+    if (!(*src & PTE_P)) return;
+
+    if ((level == 0) || ((level == 1) && (*src & PTE_2MB))) {
+        if (vaddr >= (unsigned long) KSTACK_BASE) return;
+        count = level ? PTES_PER_TABLE : 1;
+
+        if (*src & PTE_W) {
+            *src = (*src & ~PTE_W) | PTE_COW;
+            tlb_batch_add(batch, vaddr);
+            if (count > 1) tlb_batch_add(batch, vaddr + PTE_2MB_SIZE - 1);
+        }
+
+        pg = &pmap[ADDR_TO_PGNO(PTE_ADDR(*src))];
+        for (i = 0; i < count; ++i) ++pg[i].refs;
+        *dst = *src;
+    } else {
+        if (!(*dst & PTE_P))
+            *dst = ((long) pte_alloc(child)) | PTE_P | PTE_W | PTE_U;
+
+        src_table = (pte_t *) PTE_ADDR(*src);
+        dst_table = (pte_t *) PTE_ADDR(*dst);
+        size = 1L << (((level - 1) * 9) + PAGE_SHIFT);
+
+        for (i = 0; i < PTES_PER_TABLE; ++i, vaddr += size)
+            cow(child, &src_table[i], &dst_table[i], level - 1, vaddr, batch);
+    }
+}
+
+/* give 'child' a copy-on-write view of the user address space of 'parent',
+   which must be the current process. only the page tables are copied;
+   the pages themselves are copied when (if) either side writes to them.
+   the kernel stacks are the exception: they're never shared, since the
+   kernel writes to them (with CR0.WP set, COW applies to the kernel too),
+   so the caller must copy its own stack itself. TOKEN_VM is held. */
+
+page_cow(parent, child)
+struct proc *parent;
+struct proc *child;
+{
+    struct tlb_batch batch;
+    unsigned long vaddr;
+    token_t tokens;
+    int i;
+
+    tlb_batch_init(&batch, parent->vm);
+    tokens = acquire(TOKEN_PMAP);
+
+    for (i = 1; i < PTES_PER_TABLE; ++i) {
+        vaddr = (unsigned long) i << ((3 * 9) + PAGE_SHIFT);
+        if (i >= PTES_PER_TABLE / 2) vaddr |= 0xFFFF000000000000L;
+        cow(child, &parent->vm->cr3[i], &child->vm->cr3[i], 3, vaddr,
+            &batch);
+    }
+
+    release(tokens);
+    tlb_batch_flush(&batch);
+}
+
+/* remove the mappings in [start, end) from 'proc', adding them to 'batch'
+   for the caller to flush. pages whose last reference goes are moved to
+   'list' for page_free_list(), which must wait until after the flush. */
+
+page_unmap(proc, start, end, batch, list)
+struct proc *proc;
+unsigned long start;
+unsigned long end;
+struct tlb_batch *batch;
+struct pmap_list *list;
+{
+    token_t tokens;
+    unsigned long next;
+    pte_t *pte;
+
+    tokens = acquire(TOKEN_PMAP);
+
+    while (start < end) {
+        pte = page_pte(proc, start, 0);
+
+        if (pte == NULL) {
+            /* no page table here, so skip to the next one */
+
+            next = (start + PTE_2MB_SIZE) & ~(PTE_2MB_SIZE - 1);
+            if (next < start) break;
+            start = next;
+            continue;
+        }
+
+        if ((*pte & PTE_P) && (*pte & PTE_2MB)) {
+            /* a whole 2MB page goes at once; if we only want
+               part of it, break it up and take it a page at a time */
+
+            if (PTE_2MB_OFFSET(start) || ((end - start) < PTE_2MB_SIZE)) {
+                page_split(proc, start);
+                continue;
+            }
+
+            page_unref(&pmap[ADDR_TO_PGNO(PTE_ADDR(*pte))],
+                       PTES_PER_TABLE, list);
+
+            *pte = 0;
+            tlb_batch_add(batch, start);
+            tlb_batch_add(batch, start + PTE_2MB_SIZE - 1);
+            start += PTE_2MB_SIZE;
+            continue;
+        }
+
+        if (*pte & PTE_P) {
+            page_unref(&pmap[ADDR_TO_PGNO(PTE_ADDR(*pte))], 1, list);
+            *pte = 0;
+            tlb_batch_add(batch, start);
+        }
+
+        start += PAGE_SIZE;
+    }
+
+    release(tokens);
+}
+
+/* resolve a write fault at 'vaddr' in 'proc' (the current process) on a
+   PTE_COW page. if we hold the only reference, the page is simply made
+   writeable again; otherwise we take a private copy. returns 0 if 'vaddr'
+   isn't actually a COW page, non-zero if the fault is resolved. */
+
+static
+cow_fault(proc, vaddr, code)
+struct proc *proc;
+unsigned long vaddr;
+{
+    struct tlb_batch batch;
+    struct pmap *pg;
+    token_t tokens;
+    pgno_t pgno;
+    pte_t *pte;
+    pte_t old;
+    int i;
+
+    vaddr &= ~(PAGE_SIZE - 1L);
+    tokens = acquire(TOKEN_PMAP);
+    pte = page_pte(proc, vaddr, 0);
+
+    if ((pte == NULL) || !(*pte & PTE_P)
+      || ((code & PF_U) && !(*pte & PTE_U)))
+    {
+        release(tokens);
+        return 0;
+    }
+
+    /* a stale read-only TLB entry, left by an earlier fault that found
+       we were the last reference. there's nothing to do but drop it. */
+
+    if (*pte & PTE_W) {
+        release(tokens);
+        invlpg(vaddr);
+        return 1;
+    }
+
+    if (!(*pte & PTE_COW)) {
+        release(tokens);
+        return 0;
+    }
+
+    pg = &pmap[ADDR_TO_PGNO(PTE_ADDR(*pte))];
+
+    /* a 2MB page can be made writeable whole if it's no longer shared at
+       all. otherwise it's split, so only the 4K page written is copied. */
+
+    if (*pte & PTE_2MB) {
+        for (i = 0; i < PTES_PER_TABLE; ++i)
+            if (pg[i].refs != 1) break;
+
+        if (i == PTES_PER_TABLE) {
+            *pte = (*pte & ~PTE_COW) | PTE_W;
+            release(tokens);
+            invlpg(vaddr);
+            return 1;
+        }
+
+        /* page_split() may sleep, so what's there afterwards needn't be
+           what we saw. leave the rest to the fault that follows, which
+           will find the 4K page (or whatever else) that's there now. */
+
+        page_split(proc, vaddr);
+        release(tokens);
+        invlpg(vaddr);
+        return 1;
+    }
+
+    if (pg->refs == 1) {
+        *pte = (*pte & ~PTE_COW) | PTE_W;
+        release(tokens);
+        invlpg(vaddr);
+        return 1;
+    }
+
+    /* page_alloc() might sleep, and meanwhile a sibling thread may resolve
+       this same fault, or the other references may go away. so once we
+       have the page, look again: if the PTE no longer maps the same COW
+       page, someone else has dealt with it, and if we're now the last
+       reference, we can have it after all. either way, ours goes back. */
+
+    old = *pte;
+    pgno = page_alloc(PMAP_ANON, vaddr);
+    pte = page_pte(proc, vaddr, 0);
+
+    if ((pte == NULL) || !(*pte & PTE_P) || !(*pte & PTE_COW)
+      || (*pte & PTE_2MB) || (PTE_ADDR(*pte) != PTE_ADDR(old)))
+    {
+        page_free(pgno);
+        release(tokens);
+        return 1;
+    }
+
+    if (pg->refs == 1) {
+        page_free(pgno);
+        *pte = (*pte & ~PTE_COW) | PTE_W;
+        release(tokens);
+        invlpg(vaddr);
+        return 1;
+    }
+
+    bcopy(PTE_ADDR(*pte), PGNO_TO_ADDR(pgno), PAGE_SIZE);
+    *pte = PGNO_TO_ADDR(pgno) | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+    if (--pg->refs == 0) page_free(pg - pmap);
+    release(tokens);
+
+    tlb_batch_init(&batch, proc->vm);
+    tlb_batch_add(&batch, vaddr);
+    tlb_batch_flush(&batch);
+
+    return 1;
+}
+
+/* called by trap() on a page fault, with the error 'code' from the CPU.
+   returns non-zero if the fault was handled, or 0 if it's a real error.
+   TOKEN_VM keeps sibling threads from changing the address space under us. */
+
+page_fault(code)
+{
+    struct proc *proc = this()->curproc;
+    unsigned long vaddr;
+    token_t tokens;
+    int handled;
+
+    vaddr = cr2();
+    tokens = acquire(TOKEN_VM);
+
+    if (!(code & PF_P))
+        handled = vm_fault(proc, vaddr, code);
+    else if (code & PF_W)
+        handled = cow_fault(proc, vaddr, code);
+    else
+        handled = 0;
+
+    release(tokens);
+    return handled;
 }
 
 /* locore.s queries the BIOS and exports e820_map[] and nr_e820 */
@@ -169,6 +723,77 @@ extern int nr_e820;
 
 #define E820_TYPE_USABLE 1
 
+/* returns non-zero if the pages [first, last] are all usable RAM, going
+   by the (already converted) e820_map[]: every page must lie in a usable
+   entry, and none may be touched by an unusable one, as they can overlap. */
+
+static
+e820_usable(first, last)
+pgno_t first, last;
+{
+    union e820 *entry;
+    pgno_t pgno;
+    int i;
+
+    for (i = 0, entry = e820_map; i < nr_e820; ++i, ++entry)
+        if (!entry->pages.usable && (entry->pages.first <= last)
+          && (entry->pages.last >= first))
+            return 0;
+
+    pgno = first;
+
+    while (pgno <= last) {
+        for (i = 0, entry = e820_map; i < nr_e820; ++i, ++entry)
+            if (entry->pages.usable && (entry->pages.first <= pgno)
+              && (entry->pages.last >= pgno))
+                break;
+
+        if (i == nr_e820) return 0;
+        if (entry->pages.last >= last) break;
+        pgno = entry->pages.last + 1;
+    }
+
+    return 1;
+}
+
+/* if the CPU supports 1GB pages, identity-map as much of [0, end) as we can
+   with them. these go straight into the PDPT that locore built for proto_pml4
+   (we assume end <= 512GB) so no page tables need be allocated. GB 0 is left
+   alone, since locore mapped it with 2MB pages that we're running on, as is
+   any GB with the APICs, which apic_init() maps with 2MB pages of its own.
+   so is any GB that isn't entirely RAM: a 1GB page that spans an MMIO hole
+   or reserved range has an undefined memory type. whatever isn't covered
+   here is left to page_init() to map in 2MB pages. */
+
+static
+page_init_1gb(end)
+unsigned long end;
+{
+    unsigned regs[4];
+    unsigned long addr;
+    pte_t *pdpt;
+
+    cpuid(CPUID_EXT, 0, regs);
+    if (regs[0] < CPUID_EXT_1) return;
+    cpuid(CPUID_EXT_1, 0, regs);
+    if (!(regs[3] & CPUID_EXT_1_EDX_1GB)) return;
+
+    pdpt = (pte_t *) PTE_ADDR(proto_pml4[0]);
+
+    for (addr = PTE_1GB_SIZE; (addr + PTE_1GB_SIZE) <= end;
+      addr += PTE_1GB_SIZE)
+    {
+        if (addr == (LAPIC_BASE & ~(PTE_1GB_SIZE - 1))) continue;
+        if (addr == (IOAPIC_BASE & ~(PTE_1GB_SIZE - 1))) continue;
+
+        if (!e820_usable(ADDR_TO_PGNO(addr),
+                         ADDR_TO_PGNO(addr + PTE_1GB_SIZE - 1)))
+            continue;
+
+        pdpt[PTE_INDEX(addr, 2)] = addr | PTE_1GB | PTE_G | PTE_W | PTE_P;
+    }
+}
+
 /* this is called very early by main(), with only the first 2MB mapped, to
  * initialize the pmap[] and complete the kernel identity-mapping of RAM. */
 
@@ -224,16 +849,24 @@ page_init()
 
     /* finally, iterate over all page frames in the system and categorize them
        accordingly. (pmap[0] is unavailable because pgno_t 0 means 'no page'.)
-       at every 2MB boundary we make sure to extend the kernel page tables. */
+       at every 2MB boundary we make sure to extend the kernel page tables,
+       unless page_init_1gb() has already mapped the area with a 1GB page. */
+
+    page_init_1gb(PGNO_TO_ADDR(pmapsz));
 
     pmap[0].type = PMAP_UNAVAIL;
 
+    nr_pages = pmapsz;
+
     for (pgno = 1; pgno < pmapsz; ++pgno) {
+        pmap[pgno].node = 0;    /* until page_numa() */
+
         if ((PGNO_TO_ADDR(pgno) % (2 * 1024 * 1024)) == 0) {
             pte_t *pte;
 
             pte = page_pte(&proc0, PGNO_TO_ADDR(pgno), PTE_2MB | PTE_P);
-            *pte = PGNO_TO_ADDR(pgno) | PTE_2MB | PTE_G | PTE_W | PTE_P;
+            if (!(*pte & PTE_P))
+                *pte = PGNO_TO_ADDR(pgno) | PTE_2MB | PTE_G | PTE_W | PTE_P;
         }
 
         if ((pgno >= kernel_first) && (pgno <= kernel_last)) {
@@ -270,4 +903,68 @@ page_init()
             nr_free_pages);
 }
 
+/* called by the BSP after acpi_init(), before the APs are started: tag
+   the pages in pmap[] with their NUMA nodes, according to the ranges in
+   the SRAT, moving the free ones to their nodes' free lists. pages that
+   aren't in any range stay on node 0. then rank the nodes by distance
+   from each node, closest (i.e., itself) first, for page_alloc(). */
+
+page_numa()
+{
+    token_t tokens;
+    struct numa_range *range;
+    struct pmap *pg;
+    unsigned long end;
+    pgno_t pgno, last;
+    pgno_t count;
+    int placed;
+    int best;
+    int i, j, n;
+
+    if (nr_nodes == 1) return;
+
+    tokens = acquire(TOKEN_PMAP);
+
+    for (i = 0, range = numa_ranges; i < nr_numa_ranges; ++i, ++range) {
+        end = range->base + range->len;
+        if (end > PGNO_TO_ADDR(nr_pages)) end = PGNO_TO_ADDR(nr_pages);
+        if (range->base >= end) continue;
+
+        last = ADDR_TO_PGNO(end - 1);
+
+        for (pgno = ADDR_TO_PGNO(range->base); pgno <= last; ++pgno) {
+            pg = &pmap[pgno];
+            pg->node = range->node;
+
+            if (pg->type == PMAP_FREE) {
+                LIST_REMOVE(pg, list);
+                LIST_INSERT_HEAD(&free_pages[pg->node], pg, list);
+            }
+        }
+    }
+
+    for (n = 0; n < nr_nodes; ++n) {
+        for (placed = 0, i = 0; i < nr_nodes; ++i) {
+            for (best = -1, j = 0; j < nr_nodes; ++j) {
+                if (placed & (1 << j)) continue;
+                if ((best == -1)
+                  || (acpi_distance(n, j) < acpi_distance(n, best)))
+                    best = j;
+            }
+
+            placed |= 1 << best;
+            fallback[(n * NR_NODES) + i] = best;
+        }
+    }
+
+    nodes = nr_nodes;
+    release(tokens);
+
+    for (n = 0; n < nodes; ++n) {
+        count = 0;
+        LIST_FOREACH(pg, &free_pages[n], list) ++count;
+        printf("node %d: %d free pages\n", n, count);
+    }
+}
+
 /* vi: set ts=4 expandtab: */
@@ -23,6 +23,7 @@
  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "../include/stddef.h"
+#include "../include/a.out.h"
 #include "../include/sys/param.h"
 #include "../include/sys/queue.h"
 #include "../include/sys/types.h"
@@ -31,6 +32,9 @@
 #include "../include/sys/sched.h"
 #include "../include/sys/proc.h"
 #include "../include/sys/seg.h"
+#include "../include/sys/tlb.h"
+#include "../include/sys/vm.h"
+#include "../include/sys/exec.h"
 
 struct slab proc_slab = SLAB_INITIALIZER(proc_slab, sizeof(struct proc));
 
@@ -41,10 +45,127 @@ int nr_procs;                   /* number of processes */
 
 TAILQ_HEAD(,proc) all_procs = TAILQ_HEAD_INITIALIZER(all_procs);
 
+/* proc_cache holds "skeletons": procs with no identity, but with a PML4,
+   kernel stack and the tables that map it all ready to go, so proc_alloc()
+   needn't build them. the reaper keeps it stocked, partly by recycling the
+   procs which have exited (and wait on 'zombies' to be freed) and partly by
+   building new skeletons whenever it falls below PROC_CACHE_LOW. */
+
+#define NR_PROC_CACHE   16
+#define PROC_CACHE_LOW  (NR_PROC_CACHE / 2)
+
+static TAILQ_HEAD(, proc) zombies = TAILQ_HEAD_INITIALIZER(zombies);
+static TAILQ_HEAD(, proc) proc_cache = TAILQ_HEAD_INITIALIZER(proc_cache);
+static int nr_cached;                   /* including any being added */
+
+/* PIDs in use are tracked in a two-level bitmap: a bit is set in pid_map[]
+   for each allocated PID, and a bit is set in pid_full[] for each qword of
+   pid_map[] that has no clear bits, so searches can skip past it. */
+
+#define PID_MAP_WORDS   (NR_PIDS / 64)
+#define PID_FULL_WORDS  (PID_MAP_WORDS / 64)
+
+static unsigned long pid_map[PID_MAP_WORDS];
+static unsigned long pid_full[PID_FULL_WORDS];
+
+/* processes are also hashed by PID into pid_hash[] for proc_find() */
+
+#define NR_PID_HASH     256     /* must be a power of two */
+#define PID_HASH(pid)   ((pid) & (NR_PID_HASH - 1))
+
+static LIST_HEAD(, proc) pid_hash[NR_PID_HASH];
+
+/* return the lowest free PID at or above 'pid', or -1 if there isn't one */
+
+static pid_t
+pid_search(pid)
+pid_t pid;
+{
+    unsigned long bits;
+    int word;
+    int full;
+
+    word = pid / 64;
+    bits = ~pid_map[word] & (-1L << (pid % 64));
+    if (bits) return (word * 64) + bsf(bits);
+
+    /* not in the first (partial) qword, so consult pid_full[] to find
+       the next qword in pid_map[] which has at least one clear bit. */
+
+    for (++word; word < PID_MAP_WORDS; word = full * 64) {
+        full = word / 64;
+        bits = ~pid_full[full] & (-1L << (word % 64));
+
+        if (bits) {
+            word = (full * 64) + bsf(bits);
+            return (word * 64) + bsf(~pid_map[word]);
+        }
+
+        ++full;
+    }
+
+    return -1;
+}
+
+/* allocate a PID, called with TOKEN_PROC held. PIDs are assigned in
+   increasing order, wrapping around, so they are not reused too quickly. */
+
+static pid_t
+pid_alloc()
+{
+    pid_t pid;
+    int word;
+
+    pid = -1;
+    if (last_pid < NR_PIDS - 1) pid = pid_search(last_pid + 1);
+    if (pid == -1) pid = pid_search(1);
+    if (pid == -1) panic("out of PIDs");
+
+    word = pid / 64;
+    pid_map[word] |= 1L << (pid % 64);
+    if (pid_map[word] == -1L) pid_full[word / 64] |= 1L << (word % 64);
+
+    last_pid = pid;
+    return pid;
+}
+
+/* return a PID to the pool, called with TOKEN_PROC held. */
+
+static
+pid_free(pid)
+pid_t pid;
+{
+    int word = pid / 64;
+
+    pid_map[word] &= ~(1L << (pid % 64));
+    pid_full[word / 64] &= ~(1L << (word % 64));
+}
+
+/* return the process with the given PID, or NULL if there is none. */
+
+struct proc *
+proc_find(pid)
+pid_t pid;
+{
+    struct proc *proc;
+    token_t tokens;
+
+    tokens = acquire(TOKEN_PROC);
+
+    LIST_FOREACH(proc, &pid_hash[PID_HASH(pid)], pid_links)
+        if (proc->pid == pid) break;
+
+    release(tokens);
+    return proc;
+}
+
 /* initialize a new struct proc to a sane state and add it to the all_procs
-   list. this is meant to be called only from two places: early main() and
-   proc_alloc(). in the latter case, TOKEN_PROC is held when this is called.
-   in the former, there is no need because we're not scheduling yet. */
+   list and pid_hash[]. this is meant to be called only from three places:
+   early main(), proc_alloc() and thread_create(). in the latter cases,
+   TOKEN_PROC is held when this is called. in the former, there is no need
+   because we're not scheduling yet. (the pid_hash[] buckets are empty, so
+   need no LIST_INIT.) 'vm' and 'kstack' are left alone: the caller has
+   already attached the proc to its address space. */
 
 proc_init(pid, proc)
 pid_t pid;
@@ -54,28 +175,33 @@ struct proc *proc;
     proc->flags = 0;
     proc->priority = PRIORITY_IDLE;
     proc->tokens = 0;
-    LIST_INIT(&proc->pte_pages);
+    proc->pcid = 0;
+    proc->last_cpu = -1;
     TAILQ_INSERT_HEAD(&all_procs, proc, all_links);
+    LIST_INSERT_HEAD(&pid_hash[PID_HASH(pid)], proc, pid_links);
     ++nr_procs;
 
     /* usually, these fields will be overwritten with data from the parent
        (via a standard fork), but provide values here that apply to early
        procs that are hand-crafted by the kernel (proc0, the idle tasks) */
 
-    proc->cpu.rsp = KSTACK_TOP;
+    proc->cpu.rsp = KSTACK_SLOT_TOP(proc->kstack);
     proc->cpu.rflags = 0; /* most importantly, IF=0 */
 }
 
-/* allocate and map in the kernel stack for a process */
+/* allocate and map in the kernel stack for a process, in its slot */
 
 proc_kstack(proc)
 struct proc *proc;
 {
-    unsigned long addr = KSTACK_TOP;
+    unsigned long addr = KSTACK_SLOT_TOP(proc->kstack);
+    token_t tokens;
     int i;
     pgno_t pgno;
     pte_t *pte;
 
+    tokens = acquire(TOKEN_VM);
+
     for (i = 0; i < KSTACK_PAGES; ++i) {
         addr -= PAGE_SIZE;
         pgno = page_alloc(PMAP_ANON, addr);
@@ -83,53 +209,219 @@ struct proc *proc;
         pte = page_pte(proc, addr, PTE_P);
         *pte = PGNO_TO_ADDR(pgno) | PTE_P | PTE_W;
     }
+
+    release(tokens);
 }
 
-/* allocate a new proc struct. assign a process ID,
-   initialize with sane defaults, attach kernel stack. */
+/* build a new skeleton: allocate a proc struct and a vmspace, and attach
+   top-level page tables and a kernel stack (in slot 0) to them. the proc
+   is not initialized otherwise.
+
+   slot 0 of every vmspace always has a stack mapped, whether or not its
+   first thread is still alive, so its skeleton can be recycled intact. */
+
+static struct proc *
+proc_skel()
+{
+    struct proc *new;
+    struct vmspace *vm;
+
+    new = (struct proc *) slab_alloc(&proc_slab);
+    vm = (struct vmspace *) slab_alloc(&vmspace_slab);
+    vm_init(vm);
+    new->vm = vm;
+    new->kstack = 0;
+
+    /* if/when we support more than 512GB of physical address space
+       (PHYSMAX), we'll need to copy more than the first proto PML4E */
+
+    vm->cr3 = pte_alloc(new);
+    vm->cr3[0] = proto_pml4[0];     /* shared kernel mappings */
+    new->cr3 = vm->cr3;
+    proc_kstack(new);
+
+    return new;
+}
+
+/* allocate a new proc struct. assign a process ID, initialize with sane
+   defaults. normally this just takes a skeleton from proc_cache; we only
+   build one here if the reaper has fallen behind. */
 
 struct proc *
 proc_alloc()
 {
     struct proc *new;
-    struct proc *proc;
     token_t tokens;
 
-    new = (struct proc *) slab_alloc(&proc_slab);
+    tokens = acquire(TOKEN_PROC);
+    new = TAILQ_FIRST(&proc_cache);
+
+    if (new) {
+        TAILQ_REMOVE(&proc_cache, new, all_links);
+        --nr_cached;
+    }
+
+    if (nr_cached < PROC_CACHE_LOW) wakeup(&zombies);
+    release(tokens);
+
+    if (new == NULL) new = proc_skel();
 
     tokens = acquire(TOKEN_PROC);
+    proc_init(pid_alloc(), new);
+    release(tokens);
 
-    /* assign an unused pid. this will loop forever if there are no free
-       pids - we never release TOKEN_PROC so none will become free. it is
-       up to other parts of the system to ensure we don't try to make a
-       ridiculous number of processes. */
+    return new;
+}
 
-    do {
-        ++last_pid;
-        if (last_pid < 0) last_pid = 0;
+/* unlink 'proc' and hand it off to the reaper. TOKEN_PROC is held. */
 
-        proc = TAILQ_FIRST(&all_procs);
-        while (proc != NULL) {
-            if (proc->pid == last_pid) break;
-            proc = TAILQ_NEXT(proc, all_links);
-        }
-    } while (proc != NULL);
+static
+zombie(proc)
+struct proc *proc;
+{
+    TAILQ_REMOVE(&all_procs, proc, all_links);
+    LIST_REMOVE(proc, pid_links);
+    pid_free(proc->pid);
+    --nr_procs;
+
+    if (TAILQ_EMPTY(&zombies)) wakeup(&zombies);
+    TAILQ_INSERT_TAIL(&zombies, proc, all_links);
+}
+
+/* terminate the current process (thread). we only unlink it and hand it
+   off to the reaper here; the real work of tearing it down is deferred, so
+   the caller (and the CPU it's on) can get on with something more useful. */
+
+proc_exit()
+{
+    acquire(TOKEN_PROC);
+    zombie(this()->curproc);
+    stop();     /* never returns; drops TOKEN_PROC */
+}
+
+/* release the kernel stack of a dead thread whose siblings live on. the
+   stack in slot 0 stays put (see proc_skel()), as does the slot itself. */
+
+static
+thread_free(proc, list)
+struct proc *proc;
+struct pmap_list *list;
+{
+    struct vmspace *vm = proc->vm;
+    struct tlb_batch batch;
+    token_t tokens;
 
-    proc_init(last_pid, new);
+    if (proc->kstack == 0) return;
+
+    tokens = acquire(TOKEN_VM);
+    tlb_batch_init(&batch, vm);
+    page_unmap(proc, KSTACK_SLOT_BASE(proc->kstack),
+               KSTACK_SLOT_TOP(proc->kstack), &batch, list);
+    tlb_batch_flush(&batch);
     release(tokens);
 
-    /* allocate and initialize the top-level page tables, then stack.
-       if/when we support more than 512GB of physical address space
-       (PHYSMAX), we'll need to copy more than the first proto PML4E */
+    tokens = acquire(TOKEN_PROC);
+    vm->kstacks &= ~(1L << proc->kstack);
+    release(tokens);
+}
 
-    new->cr3 = pte_alloc(new);
-    new->cr3[0] = proto_pml4[0];    /* shared kernel mappings */
-    proc_kstack(new);
+/* the reaper process collects all the zombies that have accumulated since
+   it last ran and frees them together: their pages go back under a single
+   acquisition of TOKEN_PMAP, and their proc structs under one TOKEN_SLAB.
+   an address space is only torn down with the last of its threads. then
+   the reaper tops up proc_cache with new skeletons, if necessary.
 
-    return new;
+   note that a zombie can't still be on its way out of a CPU by the time we
+   see it: proc_exit() holds TOKEN_PROC until stop() switches away, so we
+   can't acquire TOKEN_PROC to take it until that switch is complete. */
+
+reaper()
+{
+    TAILQ_HEAD(, proc) dead;
+    struct pmap_list pages;
+    struct proc *proc;
+    struct proc *next;
+    struct vmspace *vm;
+    token_t tokens;
+    int last;
+    int keep;
+
+    for (;;) {
+        TAILQ_INIT(&dead);
+        LIST_INIT(&pages);
+
+        tokens = acquire(TOKEN_PROC);
+
+        while (TAILQ_EMPTY(&zombies) && (nr_cached >= PROC_CACHE_LOW))
+            sleep(&zombies, 0);
+
+        TAILQ_CONCAT(&dead, &zombies, all_links);
+        release(tokens);
+
+        /* 'next' is read before 'proc' can leave 'dead': when it's cached,
+           we must go on from where we were, not from the top, where earlier
+           threads of its address space no longer have a 'vm' to look at. */
+
+        for (proc = TAILQ_FIRST(&dead); proc; proc = next) {
+            next = TAILQ_NEXT(proc, all_links);
+            vm = proc->vm;
+
+            tokens = acquire(TOKEN_PROC);
+            last = (--vm->refs == 0);
+            keep = last && (nr_cached < NR_PROC_CACHE);
+            if (keep) ++nr_cached;
+            release(tokens);
+
+            if (!last) {
+                thread_free(proc, &pages);
+                proc->vm = NULL;        /* not ours to free */
+                continue;
+            }
+
+            vm_free(proc);
+            page_strip(proc, keep, &pages);
+
+            if (keep) {
+                TAILQ_REMOVE(&dead, proc, all_links);
+                proc->kstack = 0;
+                vm->refs = 1;
+                vm->kstacks = 1;
+                vm->pcid_gen = 0;
+                vm->tlb_cpus = 0;
+                tokens = acquire(TOKEN_PROC);
+                TAILQ_INSERT_TAIL(&proc_cache, proc, all_links);
+                release(tokens);
+            }
+        }
+
+        page_free_list(&pages);
+
+        tokens = acquire(TOKEN_SLAB);
+        while (proc = TAILQ_FIRST(&dead)) {
+            TAILQ_REMOVE(&dead, proc, all_links);
+            if (proc->vm) slab_free(proc->vm);
+            slab_free(proc);
+        }
+        release(tokens);
+
+        for (;;) {
+            tokens = acquire(TOKEN_PROC);
+            keep = (nr_cached < NR_PROC_CACHE);
+            if (keep) ++nr_cached;
+            release(tokens);
+
+            if (!keep) break;
+            proc = proc_skel();
+
+            tokens = acquire(TOKEN_PROC);
+            TAILQ_INSERT_TAIL(&proc_cache, proc, all_links);
+            release(tokens);
+        }
+    }
 }
 
-/* fork process. returns the pid of the child to the parent, 0 to the child. */
+/* fork process. returns the pid of the child to the parent, 0 to the child.
+   only the calling thread is duplicated; the child has a new vmspace. */
 
 pid_t
 fork(priority)
@@ -137,6 +429,7 @@ fork(priority)
     struct proc *parent = this()->curproc;
     struct proc *child;
     unsigned long addr;
+    token_t tokens;
     int i;
     pid_t pid;
 
@@ -147,13 +440,30 @@ fork(priority)
     child->flags = parent->flags;
     child->tokens = parent->tokens;
 
-    if (save(parent))
+    /* the child's kernel stack is a copy of ours, full of pointers into
+       itself, so it must live in the same slot. the child's slot 0 stack
+       is already mapped (see proc_skel()) and simply goes unused. */
+
+    if (parent->kstack) {
+        child->kstack = parent->kstack;
+        child->vm->kstacks |= 1L << child->kstack;
+        proc_kstack(child);
+    }
+
+    if (save(parent)) {
+        sched_start();
         return 0;   /* child */
+    }
 
-    /* copy kernel stack. we'll refactor this when we actually
-       have user addresses beyond the kernel stack to copy.. */
+    /* the user address space is shared copy-on-write, but the
+       kernel stack must be copied now: we're running on it. */
+
+    tokens = acquire(TOKEN_VM);
+    vm_dup(parent, child);
+    page_cow(parent, child);
+    release(tokens);
 
-    addr = KSTACK_TOP;
+    addr = KSTACK_SLOT_TOP(parent->kstack);
 
     for (i = 0; i < KSTACK_PAGES; ++i) {
         char *src;
@@ -166,7 +476,119 @@ fork(priority)
         bcopy(src, dst, PAGE_SIZE);
     }
 
+    /* the child resumes in the middle of fork(), not sched(), with the
+       scheduler spin lock held: it mustn't take interrupts before
+       sched_start() releases the lock. */
+
     bcopy(&parent->cpu, &child->cpu, sizeof(parent->cpu));
+    child->cpu.rflags &= ~RFLAGS_IF;
+    run(child);
+
+    return pid;
+}
+
+/* the first code run by a new thread or spawned process. */
+
+static
+thread_start()
+{
+    struct proc *proc = this()->curproc;
+
+    sched_start();
+    proc->entry(proc->arg);
+    proc_exit();
+}
+
+/* create a new thread in the current process which calls 'entry(arg)' and
+   exits when it returns. the thread shares the address space of its creator
+   but gets its own PID and kernel stack. returns the new thread's pid, or
+   -1 if the process is out of kernel stack slots. */
+
+pid_t
+thread_create(priority, entry, arg)
+int (*entry)();
+char *arg;
+{
+    struct proc *parent = this()->curproc;
+    struct vmspace *vm = parent->vm;
+    struct proc *new;
+    token_t tokens;
+    int slot;
+    pid_t pid;
+
+    tokens = acquire(TOKEN_PROC);
+    slot = bsf(~vm->kstacks);
+
+    if (slot != -1) {
+        vm->kstacks |= 1L << slot;
+        ++vm->refs;
+    }
+
+    release(tokens);
+    if (slot == -1) return -1;
+
+    new = (struct proc *) slab_alloc(&proc_slab);
+    new->vm = vm;
+    new->cr3 = vm->cr3;
+    new->kstack = slot;
+    proc_kstack(new);
+
+    tokens = acquire(TOKEN_PROC);
+    proc_init(pid_alloc(), new);
+    release(tokens);
+
+    new->priority = priority;
+    new->flags = parent->flags;
+    new->entry = entry;
+    new->arg = arg;
+    new->cpu.rip = (long) thread_start;
+
+    /* the FPU state is stale, perhaps, but it's valid to load */
+
+    bcopy(parent->cpu.fxsave, new->cpu.fxsave, sizeof(new->cpu.fxsave));
+
+    pid = new->pid;
+    run(new);
+
+    return pid;
+}
+
+/* create a new process running 'image'. unlike fork(), nothing of the
+   caller is copied: the child starts from an empty skeleton, into which
+   the image is loaded directly. it begins by calling 'start(entry)' in
+   the kernel, where 'entry' is the image's entry point; like image_exec(),
+   the final transfer to user mode is left to 'start'. returns the child's
+   pid, or -1 if the image is unusable. this is much cheaper than fork()
+   followed by image_exec(), so it's the way to launch new programs. */
+
+pid_t
+spawn(priority, image, start)
+struct image *image;
+int (*start)();
+{
+    struct proc *parent = this()->curproc;
+    struct proc *child;
+    unsigned long entry;
+    token_t tokens;
+    pid_t pid;
+
+    child = proc_alloc();
+
+    if (image_load(child, image, &entry) == -1) {
+        tokens = acquire(TOKEN_PROC);
+        zombie(child);      /* never ran, so the reaper can have it now */
+        release(tokens);
+        return -1;
+    }
+
+    child->priority = priority;
+    child->flags = parent->flags;
+    child->entry = start;
+    child->arg = (char *) entry;
+    child->cpu.rip = (long) thread_start;
+    bcopy(parent->cpu.fxsave, child->cpu.fxsave, sizeof(child->cpu.fxsave));
+
+    pid = child->pid;
     run(child);
 
     return pid;
@@ -25,10 +25,12 @@
 #include "../include/stddef.h"
 #include "../include/sys/types.h"
 #include "../include/sys/queue.h"
+#include "../include/sys/param.h"
 #include "../include/sys/page.h"
 #include "../include/sys/sched.h"
 #include "../include/sys/proc.h"
 #include "../include/sys/seg.h"
+#include "../include/sys/log.h"
 
 /* the scheduler is a simple strict-priority scheduler.
 
@@ -98,6 +100,8 @@ struct isr
     int flags;                  /* ISR_* (see sys/sched.h) */
     int pin;                    /* if ISR_IOAPIC */
     token_t token;              /* sychronization token (0 = ISR free) */
+    int (*fn)();                /* handler */
+    int fired;                  /* woken by sched(), not yet handled */
 };
 
 static struct isr isrs[NR_ISR_VECTORS];
@@ -152,14 +156,27 @@ char *channel;
     unspin();
 }
 
+/* when choosing among processes of the same priority, sched() looks at up
+   to this many eligible ones for one that last ran on a CPU sharing our
+   last-level cache (see kernel/topo.c), whose working set may still be in
+   it. failing that, it takes the first, to keep things roughly fair. */
+
+#define SCHED_SCAN      4
+
+#define CACHE_WARM(proc) \
+    (((proc)->last_cpu == -1) || (this()->llc_cpus & (1L << (proc)->last_cpu)))
+
 /* LOCKED: select the best process to run and switch into it. "best" means
-   the highest-priority process who needs only tokens that are free. */
+   the highest-priority process who needs only tokens that are free, and
+   preferably one that's cache-warm here. */
 
 static
 sched()
 {
     struct proc *proc;
+    struct proc *first;
     unsigned long bits;
+    int scanned;
     int bit;
 
     /* first, if there are any pending ISRs then wake
@@ -170,6 +187,7 @@ sched()
         bit = bsf(bits);
 
         if (!(tokens & isrs[bit].token)) {
+            isrs[bit].fired = 1;
             wakeup1(&isrs[bit]);
             pending &= ~(1L << bit);
         }
@@ -184,21 +202,35 @@ sched()
         bit = bsf(bits);
         if (bit == -1) panic("runq empty");
 
+        first = NULL;
+        scanned = 0;
+
         proc = TAILQ_FIRST(&runq[bit]);
         while (proc) {
             if ((proc->tokens & tokens) == 0) {
-                if (save(this()->curproc))
-                    return; /* we've been resumed */
-                else {
-                    TAILQ_REMOVE(&runq[bit], proc, q_links);
-                    if (TAILQ_EMPTY(&runq[bit])) runqs &= ~(1L << bit);
-                    resume(proc);
-                }
+                if (first == NULL) first = proc;
+                if (CACHE_WARM(proc)) break;
+                if (++scanned == SCHED_SCAN) break;
             }
 
             proc = TAILQ_NEXT(proc, q_links);
         }
 
+        if (proc == NULL || !CACHE_WARM(proc)) proc = first;
+
+        if (proc) {
+            if (save(this()->curproc))
+                return; /* we've been resumed */
+            else {
+                TAILQ_REMOVE(&runq[bit], proc, q_links);
+                if (TAILQ_EMPTY(&runq[bit])) runqs &= ~(1L << bit);
+                proc->last_cpu = this()->cpu;
+                this()->rsp0 = KSTACK_SLOT_TOP(proc->kstack);
+                tlb_switch(proc);
+                resume(proc);
+            }
+        }
+
         bits &= ~(1L << bit);
     }
 }
@@ -326,6 +358,30 @@ char *channel;
     proc->flags &= ~flags;
 }
 
+/* give up the CPU for good: the current process is not put on any queue,
+   so it will never be scheduled again. any tokens it holds are dropped. */
+
+stop()
+{
+    struct proc *proc = this()->curproc;
+
+    spin();
+    tokens &= ~proc->tokens;
+    proc->tokens = 0;
+    sched();
+    panic("stop()");
+}
+
+/* a new process doesn't return into sched()'s caller when it's first
+   resumed, but into fork() or thread_start(): it must claim its tokens
+   and drop the spin lock itself, as the caller would have done. */
+
+sched_start()
+{
+    tokens |= this()->curproc->tokens;
+    unspin();
+}
+
 /* set a new process runnable. */
 
 run(proc)
@@ -352,6 +408,11 @@ idle()
 
 tick()
 {
+    if (this()->cpu == 0) {
+        clock_tick();
+        log_tick();
+    }
+
     lapic_eoi();
 }
 
@@ -361,6 +422,7 @@ tick()
 panic(msg)
 char *msg;
 {
+    log_panic();
     printf("panic: %s\n", msg);
     for (;;) ;
 }
@@ -374,7 +436,7 @@ struct vector *vector;
     int i;
 
     i = vector->number - VECTOR_ISR_BASE;
-    isr = &isr[i];
+    isr = &isrs[i];
 
     if ((isr->flags & (ISR_IOAPIC | ISR_LEVEL)) == (ISR_IOAPIC | ISR_LEVEL))
         ioapic_disable(isr->pin);
@@ -382,17 +444,56 @@ struct vector *vector;
     lapic_eoi();
 
     spin();
-    pending |= 1 << i;
+    pending |= 1L << i;
     unspin();
 }
 
+/* the body of every ISR process: wait for sched() to signal an interrupt,
+   and call the handler. the process holds the ISR's token throughout, and
+   like sleep(), gives it up only while waiting. an interrupt may arrive
+   while the handler is running, so the wait is skipped if it's 'fired'. */
+
+static
+isr_loop(isr)
+struct isr *isr;
+{
+    struct proc *proc = this()->curproc;
+    token_t have;
+
+    acquire(isr->token);
+    have = proc->tokens;
+
+    for (;;) {
+        spin();
+
+        if (!isr->fired) {
+            proc->channel = (char *) isr;
+            TAILQ_INSERT_TAIL(&sleepq[SLEEPQ(isr)], proc, q_links);
+            tokens &= ~have;
+            sched();
+            tokens |= have;
+        }
+
+        isr->fired = 0;
+        unspin();
+
+        isr->fn();
+
+        if ((isr->flags & (ISR_IOAPIC | ISR_LEVEL))
+          == (ISR_IOAPIC | ISR_LEVEL))
+            ioapic_enable(isr->pin);
+    }
+}
+
 /* allocate a vector for the specific priority, assign it to the source
-   specified, and start an ISR process invoke the handler function when
-   appropriate. */
+   specified, and start an ISR process to invoke the handler function when
+   appropriate. the ISR process is a kernel thread of the caller, so call
+   this from proc0. returns the vector, or -1 if none are free. */
 
 isr(priority, flags, pin, fn)
 int (*fn)();
 {
+    struct isr *isr;
     token_t token;
     int vector;
     int i;
@@ -415,7 +516,41 @@ int (*fn)();
         token = TOKEN_BLOCK;
         vector = 3 * VECTORS_PER_PRIORITY;
         break;
+    default:
+        panic("isr() priority");
+    }
+
+    spin();
+
+    for (i = vector; i < vector + VECTORS_PER_PRIORITY; ++i)
+        if (isrs[i].token == 0) {
+            isrs[i].token = token;
+            break;
+        }
+
+    unspin();
+
+    if (i == vector + VECTORS_PER_PRIORITY) return -1;
+
+    isr = &isrs[i];
+    isr->flags = flags;
+    isr->pin = pin;
+    isr->fn = fn;
+    isr->fired = 0;
+
+    if (thread_create(priority, isr_loop, isr) == -1) {
+        isr->token = 0;
+        return -1;
+    }
+
+    vector = VECTOR_ISR_BASE + i;
+
+    if (flags & ISR_IOAPIC) {
+        ioapic_configure(pin, vector, flags);
+        ioapic_enable(pin);
     }
+
+    return vector;
 }
 
 /* a primitive trap handler. in the future this will take more
@@ -424,6 +559,9 @@ int (*fn)();
 trap(vector)
 struct vector *vector;
 {
+    if ((vector->number == VECTOR_PF) && page_fault(vector->code))
+        return;
+
     printf("trap %d (code 0x%x)\n", vector->number, vector->code);
     printf("CS=%x RIP=%x RFLAGS=%x", vector->cs, vector->rip, vector->rflags);
     printf("SS=%x RSP=%x\n", vector->ss, vector->rsp);
@@ -22,13 +22,42 @@
  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
+#include "../include/sys/param.h"
 #include "../include/sys/seg.h"
 
+struct tss *cpus[NR_CPUS];
+int nr_cpus;
+
+/* initialize a CPU's TSS. it has no logical CPU number until tss_online(). */
+
 tss_init(tss)
 struct tss *tss;
 {
     tss->this = tss;
     tss->iomap = 0xFFFF;    /* no I/O ops outside ring 0 */
+    tss->cpu = -1;
+    tss->pcid_gen = 0;
+    tss->tsc_offset = 0;
+    tss->smt_cpus = 0;
+    tss->llc_cpus = 0;
+    tss->pkg_cpus = 0;
+    tss->node = 0;
+    tss->log_head = 0;
+    tss->log_tail = 0;
+    tss->log_lost = 0;
+    tss->log_bol = 1;
+}
+
+/* assign the CPU with 'tss' the next logical CPU number. once it's in
+   cpus[], it's fair game for TLB shootdowns and such, so it must be up. */
+
+tss_online(tss)
+struct tss *tss;
+{
+    if (nr_cpus == NR_CPUS) panic("too many CPUs");
+
+    tss->cpu = nr_cpus;
+    cpus[nr_cpus++] = tss;
 }
 
 /* allocate an entry in the GDT, fill it in with the supplied 64-bit
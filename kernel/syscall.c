@@ -0,0 +1,64 @@
+/* Copyright (c) 2019 Charles E. Youse (charles@gnuless.org).
+   All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "../include/stddef.h"
+#include "../include/sys/types.h"
+#include "../include/sys/queue.h"
+#include "../include/sys/param.h"
+#include "../include/sys/page.h"
+#include "../include/sys/sched.h"
+#include "../include/sys/proc.h"
+#include "../include/sys/seg.h"
+#include "../include/sys/futex.h"
+#include "../include/sys/syscall.h"
+
+static
+sys_getpid()
+{
+    return this()->curproc->pid;
+}
+
+struct sysent sysent[NR_SYSCALLS] =
+{
+    { proc_exit },          /* SYS_EXIT */
+    { sys_getpid },         /* SYS_GETPID */
+    { futex_wait },         /* SYS_FUTEX_WAIT */
+    { futex_wake }          /* SYS_FUTEX_WAKE */
+};
+
+/* called from the SYSCALL entry code in locore with the user's registers
+   in 'frame'. the system call gets all six argument registers, whether it
+   wants them or not. returns the result for rax: -1 for a bad number. */
+
+long
+syscall(frame)
+struct syscall *frame;
+{
+    if (frame->number >= NR_SYSCALLS) return -1;
+
+    return sysent[frame->number].call(frame->rdi, frame->rsi, frame->rdx,
+                                      frame->r10, frame->r8, frame->r9);
+}
+
+/* vi: set ts=4 expandtab: */
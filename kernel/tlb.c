@@ -0,0 +1,245 @@
+/* Copyright (c) 2019 Charles E. Youse (charles@gnuless.org).
+   All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "../include/stddef.h"
+#include "../include/sys/types.h"
+#include "../include/sys/queue.h"
+#include "../include/sys/param.h"
+#include "../include/sys/page.h"
+#include "../include/sys/sched.h"
+#include "../include/sys/proc.h"
+#include "../include/sys/seg.h"
+#include "../include/sys/tlb.h"
+#include "../include/sys/vm.h"
+
+/* if the CPU supports PCIDs, each address space is tagged with one, so
+   a context switch need not flush the TLB: the entries belonging to other
+   address spaces simply go unused until their owners are resumed again.
+
+   PCIDs are handed out from a single pool shared by all CPUs. when the pool
+   is exhausted, we start a new generation: every vmspace must then get a
+   new PCID before it runs again, and every CPU must flush its TLB before it
+   runs anyone with a PCID from the new generation. so a given PCID only ever
+   identifies one address space in each CPU's TLB, without us having to keep
+   track of which PCIDs are cached where.
+
+   these are all protected by the scheduler spin lock. */
+
+static int pcid_enabled;                /* CR4.PCIDE set on all CPUs */
+static unsigned long pcid_gen = 1;      /* current PCID generation */
+static int pcid_next = 1;               /* next PCID to assign */
+
+/* called by each CPU at startup, before it schedules anything. */
+
+tlb_init()
+{
+    unsigned regs[4];
+
+    cpuid(1, 0, regs);
+
+    if (regs[2] & CPUID_1_ECX_PCID) {
+        cr4_set(CR4_PCIDE);
+        pcid_enabled = 1;
+    }
+}
+
+/* LOCKED: called by the scheduler just before it resume()s 'proc' on this
+   CPU, to set the PCID that resume() will load into CR3 with proc->cr3.
+
+   vm->tlb_cpus records the CPUs whose TLBs may hold valid entries tagged
+   with the PCID. a shootdown removes CPUs which aren't running in 'vm' from
+   the set instead of interrupting them; they flush here when they return. */
+
+tlb_switch(proc)
+struct proc *proc;
+{
+    struct vmspace *vm = proc->vm;
+    struct tss *tss;
+    unsigned long bit;
+
+    if (!pcid_enabled) return;
+
+    if (vm->pcid_gen != pcid_gen) {
+        if (pcid_next == NR_PCIDS) {
+            ++pcid_gen;
+            pcid_next = 1;
+        }
+
+        vm->pcid = pcid_next++;
+        vm->pcid_gen = pcid_gen;
+        vm->tlb_cpus = 0;
+    }
+
+    tss = this();
+    bit = 1L << tss->cpu;
+
+    if (tss->pcid_gen != pcid_gen) {
+        tlb_flush_all();
+        tss->pcid_gen = pcid_gen;
+    }
+
+    if (vm->tlb_cpus & bit)
+        proc->pcid = vm->pcid | CR3_NOFLUSH;
+    else {
+        proc->pcid = vm->pcid;
+        vm->tlb_cpus |= bit;
+    }
+}
+
+/* start a new, empty batch of invalidations for 'vm' */
+
+tlb_batch_init(batch, vm)
+struct tlb_batch *batch;
+struct vmspace *vm;
+{
+    batch->vm = vm;
+    batch->nr_pages = 0;
+}
+
+/* add the page at 'vaddr' to the batch */
+
+tlb_batch_add(batch, vaddr)
+struct tlb_batch *batch;
+unsigned long vaddr;
+{
+    vaddr &= ~(PAGE_SIZE - 1L);
+
+    if (batch->nr_pages == 0) {
+        batch->first = vaddr;
+        batch->last = vaddr;
+    } else {
+        if (vaddr < batch->first) batch->first = vaddr;
+        if (vaddr > batch->last) batch->last = vaddr;
+    }
+
+    ++batch->nr_pages;
+}
+
+/* invalidate the batch in this CPU's TLB. if the batch is for a vmspace,
+   it is assumed to be current, i.e., its PCID is loaded. */
+
+static
+tlb_local(batch)
+struct tlb_batch *batch;
+{
+    unsigned long vaddr;
+    unsigned long pages;
+
+    if (batch->vm == NULL) {
+        tlb_flush_all();
+        return;
+    }
+
+    pages = ((batch->last - batch->first) >> PAGE_SHIFT) + 1;
+
+    if (pages > TLB_BATCH_MAX)
+        tlb_flush();
+    else {
+        vaddr = batch->first;
+        while (pages--) {
+            invlpg(vaddr);
+            vaddr += PAGE_SIZE;
+        }
+    }
+}
+
+/* the request currently being processed and the CPUs which have completed
+   it, protected by TOKEN_TLB. one request is outstanding at any time. */
+
+static struct tlb_batch shootdown;
+static char acks[NR_CPUS];
+
+/* invalidate the entries in a batch on all CPUs that might have cached
+   them, then empty the batch. the caller must have already updated the
+   page tables. this will block until every affected CPU has responded. */
+
+tlb_batch_flush(batch)
+struct tlb_batch *batch;
+{
+    struct vmspace *vm = batch->vm;
+    unsigned long running;
+    unsigned long self;
+    token_t tokens;
+    int i;
+
+    if (batch->nr_pages == 0) return;
+
+    tokens = acquire(TOKEN_TLB);
+    bcopy(batch, &shootdown, sizeof(shootdown));
+    batch->nr_pages = 0;
+
+    /* with the scheduler locked, nobody can switch in or out of 'vm'.
+       the CPUs running in it must be interrupted; the others needn't be,
+       as tlb_switch() will flush before they next run it, if necessary. */
+
+    spin();
+    self = 1L << this()->cpu;
+    running = 0;
+
+    for (i = 0; i < nr_cpus; ++i)
+        if ((vm == NULL) || (cpus[i]->curproc->vm == vm))
+            running |= 1L << i;
+
+    if (vm) vm->tlb_cpus &= running;
+    if (running & self) tlb_local(&shootdown);
+    unspin();
+
+    running &= ~self;
+
+    for (i = 0; i < nr_cpus; ++i) {
+        if (running & (1L << i)) {
+            acks[i] = 0;
+            lapic_sendipi(cpus[i]->apic_id, VECTOR_TLB);
+        }
+    }
+
+    for (i = 0; i < nr_cpus; ++i)
+        if (running & (1L << i))
+            while (!acks[i]) pause();
+
+    release(tokens);
+}
+
+/* called from locore on receipt of a VECTOR_TLB IPI. the target may have
+   switched away from the vmspace since the IPI was sent, in which case we
+   need only make sure tlb_switch() flushes if/when it switches back. */
+
+tlb_ipi()
+{
+    struct tss *tss = this();
+
+    lapic_eoi();
+
+    if ((shootdown.vm == NULL) || (tss->curproc->vm == shootdown.vm))
+        tlb_local(&shootdown);
+    else {
+        spin();
+        shootdown.vm->tlb_cpus &= ~(1L << tss->cpu);
+        unspin();
+    }
+
+    acks[tss->cpu] = 1;
+}
+
+/* vi: set ts=4 expandtab: */
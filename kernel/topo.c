@@ -0,0 +1,187 @@
+/* Copyright (c) 2019 Charles E. Youse (charles@gnuless.org).
+   All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "../include/stddef.h"
+#include "../include/sys/param.h"
+#include "../include/sys/seg.h"
+#include "../include/sys/acpi.h"
+
+/* CPU topology. each CPU identifies itself with CPUID: the topology leaf
+   (0x1F, or the older 0xB) says how many low bits of its APIC ID select the
+   thread within the core, and how many the core (etc.) within the package.
+   the deterministic cache leaf (4, or AMD's 0x8000001D) tells how many
+   logical CPUs share each cache, which gives the same for the last-level
+   cache. CPUs whose APIC IDs agree above those bits are siblings.
+
+   from that, topo_build() gives each CPU its scheduling domains: bitmaps
+   of the logical CPUs sharing its core, last-level cache, and package.
+   the NUMA node of each CPU comes from the SRAT, by the same APIC ID. */
+
+#define CPUID_FEATURES      0x01
+#define CPUID_FEATURES_HTT  0x10000000  /* EDX: EBX[23:16] is valid */
+#define CPUID_CACHE         0x04        /* deterministic cache params */
+#define CPUID_TOPO          0x0B        /* extended topology */
+#define CPUID_TOPO2         0x1F        /* V2 extended topology */
+#define CPUID_EXT           0x80000000
+#define CPUID_EXT_CACHE     0x8000001D  /* AMD cache params (as leaf 4) */
+
+#define TOPO_SMT            1           /* CPUID_TOPO ECX[15:8]: thread */
+
+/* the smallest 'shift' such that (1 << shift) >= n */
+
+static
+order(n)
+unsigned n;
+{
+    int shift = 0;
+
+    while ((1 << shift) < n) ++shift;
+    return shift;
+}
+
+/* returns the number of logical CPUs sharing the last-level cache,
+   according to 'leaf' (CPUID_CACHE or CPUID_EXT_CACHE), or 0 if unknown */
+
+static
+llc_sharing(leaf)
+{
+    unsigned regs[4];
+    int level = 0;
+    int sharing = 0;
+    int i;
+
+    for (i = 0; ; ++i) {
+        cpuid(leaf, i, regs);
+        if ((regs[0] & 0x1F) == 0) break;
+
+        if (((regs[0] >> 5) & 7) > level) {
+            level = (regs[0] >> 5) & 7;
+            sharing = ((regs[0] >> 14) & 0xFFF) + 1;
+        }
+    }
+
+    return sharing;
+}
+
+/* called by each CPU as it starts, to identify its place in the topology.
+   this must be done on the CPU in question, as CPUID reports on itself. */
+
+topo_cpu()
+{
+    struct tss *tss = this();
+    unsigned regs[4];
+    unsigned max;
+    unsigned id;
+    int smt_shift = 0;
+    int llc_shift = -1;
+    int pkg_shift = 0;
+    int sharing = 0;
+    int leaf = 0;
+    int type;
+    int i;
+
+    cpuid(0, 0, regs);
+    max = regs[0];
+
+    cpuid(CPUID_FEATURES, 0, regs);
+    id = regs[1] >> 24;
+
+    if (regs[3] & CPUID_FEATURES_HTT)
+        pkg_shift = order((regs[1] >> 16) & 0xFF);
+
+    if (max >= CPUID_TOPO2) {
+        cpuid(CPUID_TOPO2, 0, regs);
+        if (regs[1]) leaf = CPUID_TOPO2;
+    }
+
+    if (!leaf && (max >= CPUID_TOPO)) {
+        cpuid(CPUID_TOPO, 0, regs);
+        if (regs[1]) leaf = CPUID_TOPO;
+    }
+
+    if (leaf) {
+        for (i = 0; ; ++i) {
+            cpuid(leaf, i, regs);
+            type = (regs[2] >> 8) & 0xFF;
+            if (type == 0) break;
+
+            if (type == TOPO_SMT) smt_shift = regs[0] & 0x1F;
+            pkg_shift = regs[0] & 0x1F;
+            id = regs[3];
+        }
+    }
+
+    if (max >= CPUID_CACHE) sharing = llc_sharing(CPUID_CACHE);
+
+    if (sharing == 0) {
+        cpuid(CPUID_EXT, 0, regs);
+        if (regs[0] >= CPUID_EXT_CACHE) sharing = llc_sharing(CPUID_EXT_CACHE);
+    }
+
+    if (sharing) llc_shift = order(sharing);
+    if ((llc_shift == -1) || (llc_shift > pkg_shift)) llc_shift = pkg_shift;
+
+    tss->core_id = id >> smt_shift;
+    tss->llc_id = id >> llc_shift;
+    tss->pkg_id = id >> pkg_shift;
+    tss->node = acpi_node(id);
+}
+
+/* called on the BSP once all the CPUs are up, to build their domains */
+
+topo_build()
+{
+    struct tss *a, *b;
+    int nr_cores = 0;
+    int nr_llcs = 0;
+    int nr_pkgs = 0;
+    int i, j;
+
+    for (i = 0; i < nr_cpus; ++i) {
+        a = cpus[i];
+        a->smt_cpus = 0;
+        a->llc_cpus = 0;
+        a->pkg_cpus = 0;
+
+        for (j = 0; j < nr_cpus; ++j) {
+            b = cpus[j];
+
+            if (a->pkg_id != b->pkg_id) continue;
+            a->pkg_cpus |= 1L << j;
+            if (a->llc_id == b->llc_id) a->llc_cpus |= 1L << j;
+            if (a->core_id == b->core_id) a->smt_cpus |= 1L << j;
+        }
+
+        /* count each domain once, at its lowest-numbered CPU */
+
+        if (bsf(a->smt_cpus) == i) ++nr_cores;
+        if (bsf(a->llc_cpus) == i) ++nr_llcs;
+        if (bsf(a->pkg_cpus) == i) ++nr_pkgs;
+    }
+
+    printf("%d CPUs: %d cores, %d LLCs, %d packages\n", nr_cpus, nr_cores,
+           nr_llcs, nr_pkgs);
+}
+
+/* vi: set ts=4 expandtab: */
@@ -0,0 +1,271 @@
+/* Copyright (c) 2019 Charles E. Youse (charles@gnuless.org).
+   All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "../include/stddef.h"
+#include "../include/sys/types.h"
+#include "../include/sys/param.h"
+#include "../include/sys/sched.h"
+#include "../include/sys/log.h"
+#include "../include/sys/uart.h"
+
+/* the 16550 is addressed through 8 consecutive I/O ports. we only drive
+   COM1, at its standard address and ISA IRQ (assumed to be identity-mapped
+   to the I/O APIC pin, like everything else so far). */
+
+#define UART_PORT       0x3F8
+#define UART_PIN        4
+
+#define UART_RBR        (UART_PORT + 0)     /* receive buffer (read) */
+#define UART_THR        (UART_PORT + 0)     /* transmit holding (write) */
+#define UART_DLL        (UART_PORT + 0)     /* divisor latch LSB (DLAB) */
+#define UART_IER        (UART_PORT + 1)     /* interrupt enable */
+#define UART_DLM        (UART_PORT + 1)     /* divisor latch MSB (DLAB) */
+#define UART_IIR        (UART_PORT + 2)     /* interrupt ident (read) */
+#define UART_FCR        (UART_PORT + 2)     /* FIFO control (write) */
+#define UART_LCR        (UART_PORT + 3)     /* line control */
+#define UART_MCR        (UART_PORT + 4)     /* modem control */
+#define UART_LSR        (UART_PORT + 5)     /* line status */
+#define UART_MSR        (UART_PORT + 6)     /* modem status */
+#define UART_SCR        (UART_PORT + 7)     /* scratch */
+
+#define IER_RDA         0x01        /* received data available */
+#define IER_THRE        0x02        /* transmit holding register empty */
+
+#define IIR_NONE        0x01        /* no interrupt pending */
+#define IIR_ID          0x0E        /* mask for the IIR_* below */
+#define IIR_MSR         0x00        /* modem status */
+#define IIR_THRE        0x02        /* transmitter empty */
+#define IIR_RDA         0x04        /* received data available */
+#define IIR_RLS         0x06        /* receiver line status */
+#define IIR_TIMEOUT     0x0C        /* characters sitting in RX FIFO */
+#define IIR_FIFO        0xC0        /* FIFOs enabled (and working) */
+
+#define FCR_ENABLE      0x01        /* enable FIFOs */
+#define FCR_CLEAR_RX    0x02        /* clear receive FIFO */
+#define FCR_CLEAR_TX    0x04        /* clear transmit FIFO */
+#define FCR_TRIGGER_14  0xC0        /* RDA when 14 bytes in RX FIFO */
+
+#define LCR_8N1         0x03        /* 8 data bits, no parity, 1 stop */
+#define LCR_DLAB        0x80        /* divisor latch access */
+
+#define MCR_DTR         0x01
+#define MCR_RTS         0x02
+#define MCR_OUT2        0x08        /* gates the IRQ line on PCs */
+
+#define LSR_DR          0x01        /* data ready */
+#define LSR_THRE        0x20        /* transmitter (FIFO) empty */
+
+#define UART_DIVISOR    1           /* 115200 baud */
+#define UART_FIFO       16          /* transmit FIFO depth of a 16550A */
+
+/* the transmit and receive rings. like the kernel log rings, the indices
+   are free-running; the rings must be powers of two in size. the rings
+   and the UART itself are protected by TOKEN_TTY, which the ISR holds. */
+
+#define TX_RING         1024
+#define RX_RING         256
+
+static char tx_ring[TX_RING];
+static unsigned long tx_head;       /* next byte to queue */
+static unsigned long tx_tail;       /* next byte to send */
+
+static char rx_ring[RX_RING];
+static unsigned long rx_head;       /* next byte received */
+static unsigned long rx_tail;       /* next byte to read */
+static unsigned long rx_lost;       /* bytes dropped: ring full */
+
+static int present;                 /* found by uart_init() */
+static int live;                    /* interrupt-driven, per uart_start() */
+static int fifo = 1;                /* bytes per THRE */
+static int ier;                     /* current value of UART_IER */
+
+/* called from main(), right after cons_init(), so the serial port gets
+   all the messages the console does. the UART is programmed, interrupts
+   are left disabled, and we're registered as a (synchronous) log sink. */
+
+uart_init()
+{
+    outb(UART_SCR, 0x5A);
+    if (inb(UART_SCR) != 0x5A) return;
+
+    outb(UART_IER, 0);
+    outb(UART_LCR, LCR_DLAB);
+    outb(UART_DLL, UART_DIVISOR & 0xFF);
+    outb(UART_DLM, UART_DIVISOR >> 8);
+    outb(UART_LCR, LCR_8N1);
+    outb(UART_FCR, FCR_ENABLE | FCR_CLEAR_RX | FCR_CLEAR_TX | FCR_TRIGGER_14);
+    outb(UART_MCR, MCR_DTR | MCR_RTS | MCR_OUT2);
+
+    if ((inb(UART_IIR) & IIR_FIFO) == IIR_FIFO) fifo = UART_FIFO;
+
+    present = 1;
+    log_sink(uart_write);
+}
+
+/* the interrupt handler proper, called from the ISR process. it keeps
+   going until the UART has nothing more to say: the IRQ is edge-triggered,
+   so if we left any condition pending, we'd never hear from it again. */
+
+static
+uart_intr()
+{
+    int iir;
+    int c;
+    int n;
+
+    while (!((iir = inb(UART_IIR)) & IIR_NONE)) {
+        switch (iir & IIR_ID)
+        {
+        case IIR_RLS:
+            inb(UART_LSR);
+            break;
+
+        case IIR_RDA:
+        case IIR_TIMEOUT:
+            while (inb(UART_LSR) & LSR_DR) {
+                c = inb(UART_RBR);
+
+                if ((rx_head - rx_tail) < RX_RING)
+                    rx_ring[rx_head++ & (RX_RING - 1)] = c;
+                else
+                    ++rx_lost;
+            }
+
+            wakeup(rx_ring);
+            break;
+
+        case IIR_THRE:
+            for (n = 0; (n < fifo) && (tx_tail != tx_head); ++n)
+                outb(UART_THR, tx_ring[tx_tail++ & (TX_RING - 1)]);
+
+            if (tx_tail == tx_head) {
+                ier &= ~IER_THRE;
+                outb(UART_IER, ier);
+            }
+
+            wakeup(tx_ring);
+            break;
+
+        case IIR_MSR:
+            inb(UART_MSR);
+            break;
+        }
+    }
+}
+
+/* called by the BSP once the scheduler is running: start the ISR */
+
+uart_start()
+{
+    token_t tokens;
+
+    if (!present) return;
+    if (isr(PRIORITY_TTY, ISR_IOAPIC, UART_PIN, uart_intr) == -1) return;
+
+    tokens = acquire(TOKEN_TTY);
+    ier = IER_RDA;
+    outb(UART_IER, ier);
+    live = 1;
+    release(tokens);
+}
+
+/* write to the UART directly, a FIFO-load at a time. anything queued
+   in the transmit ring goes first, to keep the output in order. */
+
+static
+polled(buf, len)
+char *buf;
+{
+    int n;
+
+    while (tx_tail != tx_head) {
+        while (!(inb(UART_LSR) & LSR_THRE)) ;
+
+        for (n = 0; (n < fifo) && (tx_tail != tx_head); ++n)
+            outb(UART_THR, tx_ring[tx_tail++ & (TX_RING - 1)]);
+    }
+
+    while (len) {
+        while (!(inb(UART_LSR) & LSR_THRE)) ;
+
+        for (n = 0; (n < fifo) && len; ++n, --len)
+            outb(UART_THR, *buf++);
+    }
+}
+
+/* queue 'len' bytes from 'buf' for transmission, sleeping if the ring
+   fills. enabling the THRE interrupt gets the ISR going, if it isn't. this
+   is a log sink, so if 'sync' is set (or there's no ISR yet) we mustn't
+   sleep, and write out the bytes directly. */
+
+uart_write(buf, len, sync)
+char *buf;
+{
+    token_t tokens;
+
+    if (sync || !live) {
+        polled(buf, len);
+        return;
+    }
+
+    tokens = acquire(TOKEN_TTY);
+
+    while (len) {
+        if ((tx_head - tx_tail) == TX_RING) {
+            sleep(tx_ring, 0);
+            continue;
+        }
+
+        tx_ring[tx_head++ & (TX_RING - 1)] = *buf++;
+        --len;
+
+        if (!(ier & IER_THRE)) {
+            ier |= IER_THRE;
+            outb(UART_IER, ier);
+        }
+    }
+
+    release(tokens);
+}
+
+/* read up to 'len' received bytes into 'buf', sleeping until there's at
+   least one. returns the number of bytes read. */
+
+uart_read(buf, len)
+char *buf;
+{
+    token_t tokens;
+    int n;
+
+    tokens = acquire(TOKEN_TTY);
+    while (rx_head == rx_tail) sleep(rx_ring, 0);
+
+    for (n = 0; (n < len) && (rx_tail != rx_head); ++n)
+        buf[n] = rx_ring[rx_tail++ & (RX_RING - 1)];
+
+    release(tokens);
+    return n;
+}
+
+/* vi: set ts=4 expandtab: */
@@ -0,0 +1,435 @@
+/* Copyright (c) 2019 Charles E. Youse (charles@gnuless.org).
+   All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+
+ * Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "../include/stddef.h"
+#include "../include/a.out.h"
+#include "../include/sys/types.h"
+#include "../include/sys/queue.h"
+#include "../include/sys/param.h"
+#include "../include/sys/page.h"
+#include "../include/sys/slab.h"
+#include "../include/sys/sched.h"
+#include "../include/sys/proc.h"
+#include "../include/sys/tlb.h"
+#include "../include/sys/vm.h"
+#include "../include/sys/exec.h"
+#include "../include/sys/clock.h"
+
+struct slab vm_slab = SLAB_INITIALIZER(vm_slab, sizeof(struct vm_region));
+struct slab vmspace_slab = SLAB_INITIALIZER(vmspace_slab,
+                                            sizeof(struct vmspace));
+
+struct vmspace vm0;         /* the address space of proc0 */
+
+/* the regions of an address space are shared by all its threads, so they
+   (and the page tables) are manipulated only under TOKEN_VM. the reaper
+   is the exception: by the time it calls vm_free(), no threads are left. */
+
+/* initialize a new, empty 'vm'. the caller supplies the PML4. */
+
+vm_init(vm)
+struct vmspace *vm;
+{
+    LIST_INIT(&vm->pte_pages);
+    TAILQ_INIT(&vm->regions);
+    vm->refs = 1;
+    vm->kstacks = 1;
+    vm->pcid = 0;
+    vm->pcid_gen = 0;
+    vm->tlb_cpus = 0;
+}
+
+/* add a region of 'len' bytes at 'start' to the address space of 'proc',
+   backed by 'image' at 'offset' (or zero-filled, if 'image' is NULL). no
+   pages are allocated; that happens in vm_fault(). returns 0 on success,
+   or -1 if the range is misaligned, not in user space or already in use. */
+
+vm_map(proc, start, len, flags, image, offset)
+struct proc *proc;
+unsigned long start;
+unsigned long len;
+struct image *image;
+unsigned long offset;
+{
+    struct vm_region *region;
+    struct vm_region *next;
+    unsigned long end = start + len;
+    token_t tokens;
+
+    if ((start | len) & (PAGE_SIZE - 1)) return -1;
+    if ((len == 0) || (end < start)) return -1;
+    if (start < (unsigned long) USER_BASE) return -1;
+    if (end > (unsigned long) USER_TOP) return -1;
+
+    tokens = acquire(TOKEN_VM);
+
+    TAILQ_FOREACH(next, &proc->vm->regions, links)
+        if (next->end > start) break;
+
+    if (next && (next->start < end)) {
+        release(tokens);
+        return -1;
+    }
+
+    region = (struct vm_region *) slab_alloc(&vm_slab);
+    region->start = start;
+    region->end = end;
+    region->flags = flags;
+    region->image = image;
+    region->offset = offset;
+    if (image) image_ref(image);
+
+    if (next)
+        TAILQ_INSERT_BEFORE(next, region, links);
+    else
+        TAILQ_INSERT_TAIL(&proc->vm->regions, region, links);
+
+    release(tokens);
+    return 0;
+}
+
+/* remove [start, start + len) from the address space of 'proc'. regions
+   are trimmed or split as needed, and any pages in the range are released.
+   (the page tables that mapped them are left for page_strip() at exit.)
+   returns 0 on success, or -1 if the range is misaligned. */
+
+vm_unmap(proc, start, len)
+struct proc *proc;
+unsigned long start;
+unsigned long len;
+{
+    struct tlb_batch batch;
+    struct pmap_list pages;
+    struct vm_region *region;
+    struct vm_region *next;
+    struct vm_region *split;
+    unsigned long end = start + len;
+    unsigned long first;
+    unsigned long last;
+    token_t tokens;
+
+    if ((start | len) & (PAGE_SIZE - 1)) return -1;
+
+    tokens = acquire(TOKEN_VM);
+    tlb_batch_init(&batch, proc->vm);
+    LIST_INIT(&pages);
+
+    for (region = TAILQ_FIRST(&proc->vm->regions); region; region = next) {
+        next = TAILQ_NEXT(region, links);
+
+        if (region->end <= start) continue;
+        if (region->start >= end) break;
+
+        first = (region->start > start) ? region->start : start;
+        last = (region->end < end) ? region->end : end;
+        page_unmap(proc, first, last, &batch, &pages);
+
+        if ((first == region->start) && (last == region->end)) {
+            TAILQ_REMOVE(&proc->vm->regions, region, links);
+            if (region->image) image_unref(region->image);
+            slab_free(region);
+        } else if (first == region->start) {
+            region->offset += last - region->start;
+            region->start = last;
+        } else if (last == region->end)
+            region->end = first;
+        else {
+            split = (struct vm_region *) slab_alloc(&vm_slab);
+            split->start = last;
+            split->end = region->end;
+            split->flags = region->flags;
+            split->image = region->image;
+            split->offset = region->offset + (last - region->start);
+            if (split->image) image_ref(split->image);
+            region->end = first;
+            TAILQ_INSERT_AFTER(&proc->vm->regions, region, split, links);
+        }
+    }
+
+    /* the pages can't be reused until no TLB can reach them */
+
+    tlb_batch_flush(&batch);
+    release(tokens);
+    page_free_list(&pages);
+
+    return 0;
+}
+
+/* returns non-zero if [start, start + len) lies within a single region
+   of 'proc', i.e., the kernel can touch it without an unresolvable fault.
+   the answer is only good while the caller holds TOKEN_VM. */
+
+vm_mapped(proc, start, len)
+struct proc *proc;
+unsigned long start;
+unsigned long len;
+{
+    struct vm_region *region;
+    unsigned long end = start + len;
+    token_t tokens;
+    int mapped = 0;
+
+    if (end < start) return 0;
+    tokens = acquire(TOKEN_VM);
+
+    TAILQ_FOREACH(region, &proc->vm->regions, links)
+        if (region->end > start) break;
+
+    if (region && (region->start <= start) && (region->end >= end))
+        mapped = 1;
+
+    release(tokens);
+    return mapped;
+}
+
+/* getting pages for a fault can sleep, which lets go of TOKEN_VM, so a
+   sibling thread may unmap or remap the page meanwhile. returns non-zero
+   if 'vaddr' in 'proc' is still covered by 'region', with the 'flags' and
+   'image' (at 'offset') it had when the fault began. TOKEN_VM is held. */
+
+static
+region_same(proc, region, vaddr, flags, image, offset)
+struct proc *proc;
+struct vm_region *region;
+unsigned long vaddr;
+struct image *image;
+unsigned long offset;
+{
+    struct vm_region *r;
+
+    TAILQ_FOREACH(r, &proc->vm->regions, links)
+        if (r->end > vaddr) break;
+
+    return (r == region) && (r->start <= vaddr) && (r->flags == flags)
+           && (r->image == image)
+           && ((r->offset + (vaddr - r->start)) == offset);
+}
+
+/* vm_fault() for a 'region' of 'proc' backed by an image. the page comes
+   from the image's page cache. if it's being written, the process gets a
+   private copy straight away; otherwise the cached page itself is mapped,
+   COW if the region is writeable.
+
+   we look at the region and PTE again only once we have the page(s),
+   and back off if either has changed (see region_same()). the image is
+   held meanwhile, lest an unmap leave image_page() refilling its cache. */
+
+static
+image_fault(proc, region, vaddr, code)
+struct proc *proc;
+struct vm_region *region;
+unsigned long vaddr;
+{
+    struct image *image = region->image;
+    unsigned long offset = region->offset + (vaddr - region->start);
+    int flags = region->flags;
+    pgno_t cached;
+    pgno_t pgno = 0;
+    pte_t *pte;
+
+    image_ref(image);
+    cached = image_page(image, offset);
+
+    if (cached == 0) {
+        image_unref(image);
+        return 0;
+    }
+
+    if (code & PF_W) {
+        pgno = page_alloc(PMAP_ANON, vaddr);
+        bcopy(PGNO_TO_ADDR(cached), PGNO_TO_ADDR(pgno), PAGE_SIZE);
+    }
+
+    pte = page_pte(proc, vaddr, PTE_P);
+    image_unref(image);
+
+    if (!region_same(proc, region, vaddr, flags, image, offset)
+      || (*pte & PTE_P))
+    {
+        if (pgno) page_free(pgno);
+        page_release(cached);
+        return 1;
+    }
+
+    if (pgno) {
+        page_release(cached);
+        *pte = PGNO_TO_ADDR(pgno) | PTE_U | PTE_W | PTE_P;
+    } else {
+        *pte = PGNO_TO_ADDR(cached) | PTE_U | PTE_P;
+        if (flags & VM_W) *pte |= PTE_COW;
+    }
+
+    return 1;
+}
+
+/* called by page_fault(), with TOKEN_VM held, when 'proc' (the current
+   process) touches the page at 'vaddr' that isn't present. if it's in a
+   region that permits the access, a zero-filled page (4K or 2MB) is mapped
+   there; a fault just below a VM_STACK region grows the region down to
+   cover it. returns 0 if the access isn't legitimate, non-zero if the
+   fault is resolved. */
+
+vm_fault(proc, vaddr, code)
+struct proc *proc;
+unsigned long vaddr;
+{
+    struct vm_region *region;
+    unsigned long huge;
+    pgno_t pgno;
+    unsigned long offset;
+    pte_t *pte;
+    int flags;
+
+    vaddr &= ~(PAGE_SIZE - 1L);
+
+    /* the time page isn't in any region: it's in every address space */
+
+    if (vaddr == (unsigned long) TIME_PAGE) {
+        if ((code & PF_W) || (timepage == NULL)) return 0;
+        pte = page_pte(proc, vaddr, PTE_P);
+
+        if (!(*pte & PTE_P)) {
+            pgno = ADDR_TO_PGNO(timepage);
+            page_ref(pgno);
+            *pte = PGNO_TO_ADDR(pgno) | PTE_U | PTE_P;
+        }
+
+        return 1;
+    }
+
+    TAILQ_FOREACH(region, &proc->vm->regions, links)
+        if (region->end > vaddr) break;
+
+    if (region == NULL) return 0;
+
+    /* no region ending below 'vaddr' can be in the way of stack growth,
+       since 'region' is the first that ends above it */
+
+    if (vaddr < region->start) {
+        if (!(region->flags & VM_STACK)) return 0;
+        if ((region->end - vaddr) > VM_STACK_MAX) return 0;
+        region->start = vaddr;
+    }
+
+    if ((code & PF_W) && !(region->flags & VM_W)) return 0;
+    if (region->image) return image_fault(proc, region, vaddr, code);
+
+    /* as in image_fault(), getting pages may sleep: don't hold on to the
+       PTE across it, and give the page(s) back if the region's changed or
+       someone else has filled the PTE meanwhile. */
+
+    flags = region->flags;
+    offset = region->offset + (vaddr - region->start);
+
+    /* if the region covers the whole 2MB around 'vaddr', and none of it
+       has been touched yet, try to back it all with one PTE_2MB mapping.
+       if we can't find the (contiguous) RAM, fall back to a 4K page. */
+
+    huge = vaddr & ~(PTE_2MB_SIZE - 1);
+
+    if ((huge >= region->start) && ((region->end - huge) >= PTE_2MB_SIZE)) {
+        pte = page_pte(proc, huge, PTE_2MB);
+
+        if (((pte == NULL) || !(*pte & PTE_P))
+          && (pgno = page_alloc_2mb(huge)))
+        {
+            bzero(PGNO_TO_ADDR(pgno), PTE_2MB_SIZE);
+            pte = page_pte(proc, huge, PTE_2MB | PTE_P);
+
+            if (!region_same(proc, region, vaddr, flags, NULL, offset)
+              || (huge < region->start)
+              || ((region->end - huge) < PTE_2MB_SIZE)
+              || (*pte & PTE_P))
+            {
+                page_free_2mb(pgno);
+                return 1;
+            }
+
+            *pte = PGNO_TO_ADDR(pgno) | PTE_2MB | PTE_U | PTE_P;
+            if (flags & VM_W) *pte |= PTE_W;
+            return 1;
+        }
+    }
+
+    pgno = page_alloc(PMAP_ANON, vaddr);
+    bzero(PGNO_TO_ADDR(pgno), PAGE_SIZE);
+
+    pte = page_pte(proc, vaddr, PTE_P);
+
+    if (!region_same(proc, region, vaddr, flags, NULL, offset)
+      || (*pte & PTE_P))
+    {
+        page_free(pgno);
+        return 1;
+    }
+
+    *pte = PGNO_TO_ADDR(pgno) | PTE_U | PTE_P;
+    if (flags & VM_W) *pte |= PTE_W;
+
+    return 1;
+}
+
+/* give 'child' a copy of the regions of 'parent', for fork(). the
+   caller holds TOKEN_VM, so no sibling of 'parent' can change them. */
+
+vm_dup(parent, child)
+struct proc *parent;
+struct proc *child;
+{
+    struct vm_region *region;
+    struct vm_region *copy;
+
+    TAILQ_FOREACH(region, &parent->vm->regions, links) {
+        copy = (struct vm_region *) slab_alloc(&vm_slab);
+        copy->start = region->start;
+        copy->end = region->end;
+        copy->flags = region->flags;
+        copy->image = region->image;
+        copy->offset = region->offset;
+        if (copy->image) image_ref(copy->image);
+        TAILQ_INSERT_TAIL(&child->vm->regions, copy, links);
+    }
+}
+
+/* free the regions of the address space of 'proc', once its last thread
+   is dead. the pages are left to page_strip(). */
+
+vm_free(proc)
+struct proc *proc;
+{
+    struct vm_region *region;
+    token_t tokens;
+
+    tokens = acquire(TOKEN_SLAB);
+
+    while (region = TAILQ_FIRST(&proc->vm->regions)) {
+        TAILQ_REMOVE(&proc->vm->regions, region, links);
+        if (region->image) image_unref(region->image);
+        slab_free(region);
+    }
+
+    release(tokens);
+}
+
+/* vi: set ts=4 expandtab: */
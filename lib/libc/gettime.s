@@ -0,0 +1,81 @@
+; Copyright (c) 2018 Charles E. Youse (charles@gnuless.org).
+; All rights reserved.
+;
+; Redistribution and use in source and binary forms, with or without
+; modification, are permitted provided that the following conditions are met:
+;
+; * Redistributions of source code must retain the above copyright notice, this
+;   list of conditions and the following disclaimer.
+;
+; * Redistributions in binary form must reproduce the above copyright notice,
+;   this list of conditions and the following disclaimer in the documentation
+;   and/or other materials provided with the distribution.
+;
+; THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+; AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+; IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+; DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+; FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+; DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+; SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+; CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+; OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+; OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+; gettime(ts) struct timespec *ts;
+; store the current time in 'ts' and return 0. this reads the kernel's time
+; page (see sys/clock.h), so it costs no system call. keep these offsets in
+; sync with 'struct timepage' and TIME_PAGE (sys/param.h).
+
+TIME_PAGE=0xFFFFFFFFFFF3F000
+TIME_SEQ=0
+TIME_SEC=8
+TIME_NSEC=16
+TIME_TSC=24
+TIME_MULT=32
+TIME_SHIFT=32
+
+.global _gettime
+_gettime:       push rbp
+                mov rbp, rsp
+                push rsi
+                push rdi
+
+                mov rdi, TIME_PAGE
+
+_gettime_1:     mov rsi, qword [rdi, TIME_SEQ]
+                test esi, 1                     ; odd: update in progress
+                jnz _gettime_2
+
+                rdtsc
+                shl rdx, 32
+                or rax, rdx
+                sub rax, qword [rdi, TIME_TSC]
+                mul qword [rdi, TIME_MULT]      ; rdx:rax = ticks * mult
+                shr rax, TIME_SHIFT
+                shl rdx, 64 - TIME_SHIFT
+                or rax, rdx
+                add rax, qword [rdi, TIME_NSEC]
+                mov rcx, qword [rdi, TIME_SEC]
+
+                cmp rsi, qword [rdi, TIME_SEQ]
+                jz _gettime_3
+_gettime_2:     pause
+                jmp _gettime_1
+
+_gettime_3:     xor edx, edx                    ; carry whole seconds
+                mov rsi, 1000000000
+                div rsi
+                add rcx, rax
+
+                mov rdi, qword [rbp, 16]        ; 'ts'
+                mov qword [rdi], rcx
+                mov qword [rdi, 8], rdx
+
+                xor eax, eax
+                pop rdi
+                pop rsi
+                pop rbp
+                ret
+
+; vi: set ts=4 expandtab:
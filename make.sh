@@ -44,6 +44,7 @@ echo ........................................ building libc
 
 $AS -o lib/libc/bzero.o -l lib/libc/bzero.lst lib/libc/bzero.s
 $AS -o lib/libc/bcopy.o -l lib/libc/bcopy.lst lib/libc/bcopy.s
+$AS -o lib/libc/gettime.o -l lib/libc/gettime.lst lib/libc/gettime.s
 
 ############################################################
 
@@ -59,14 +60,26 @@ $CC $CFLAGS -D_KERNEL -c kernel/sched.c
 $CC $CFLAGS -D_KERNEL -c kernel/seg.c
 $CC $CFLAGS -D_KERNEL -c kernel/acpi.c
 $CC $CFLAGS -D_KERNEL -c kernel/clock.c
+$CC $CFLAGS -D_KERNEL -c kernel/hpet.c
+$CC $CFLAGS -D_KERNEL -c kernel/log.c
+$CC $CFLAGS -D_KERNEL -c kernel/uart.c
+$CC $CFLAGS -D_KERNEL -c kernel/topo.c
 $CC $CFLAGS -D_KERNEL -c kernel/slab.c
 $CC $CFLAGS -D_KERNEL -c kernel/proc.c
 $CC $CFLAGS -D_KERNEL -c kernel/apic.c
+$CC $CFLAGS -D_KERNEL -c kernel/tlb.c
+$CC $CFLAGS -D_KERNEL -c kernel/vm.c
+$CC $CFLAGS -D_KERNEL -c kernel/exec.c
+$CC $CFLAGS -D_KERNEL -c kernel/futex.c
+$CC $CFLAGS -D_KERNEL -c kernel/syscall.c
 
 $LD -o kernel/kernel -e start -b 0x1000 \
 	kernel/locore.o kernel/lib.o kernel/main.o kernel/cons.o \
 	kernel/page.o kernel/sched.o kernel/seg.o kernel/acpi.o \
 	kernel/clock.o kernel/slab.o kernel/proc.o kernel/apic.o \
+	kernel/tlb.o kernel/vm.o kernel/exec.o kernel/futex.o \
+	kernel/syscall.o kernel/hpet.o kernel/log.o kernel/uart.o \
+	kernel/topo.o \
 	lib/libc/bzero.o lib/libc/bcopy.o
 
 $OBJ -s kernel/kernel >kernel/kernel.map